@@ -0,0 +1,118 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <uthread.h>
+
+// Helpers shared by the benchmarks. Each benchmark times a number of batches
+// of operations and prints one JSON object per line:
+//
+//   {"bench": ..., "policy": ..., "threads": ..., "ops": ...,
+//    "ns_per_op": ..., "p50": ..., "p90": ..., "p99": ..., "p999": ..., "max": ...}
+//
+// ns_per_op is the mean over all timed operations. The percentiles are of the
+// mean cost of an operation within each batch, in nanoseconds, since single
+// operations are too short to time individually.
+
+struct bench {
+    const char *name;
+    sched_policy policy;
+    int threads;
+    double *samples;  // ns per operation in each batch
+    int nsamples;
+    int capacity;
+    uint64_t start;
+    uint64_t total_ns;
+    uint64_t total_ops;
+};
+
+static inline uint64_t bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline const char *bench_policy_name(sched_policy policy) {
+    switch (policy) {
+        case FIFO: return "FIFO";
+        case PS: return "PS";
+        case FAIR: return "FAIR";
+        case EDF: return "EDF";
+        default: return "?";
+    }
+}
+
+// Parses a policy name, exiting on an unknown one
+static inline sched_policy bench_policy(const char *name) {
+    sched_policy policies[] = { FIFO, PS, FAIR, EDF };
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, bench_policy_name(policies[i])) == 0)
+            return policies[i];
+    }
+    fprintf(stderr, "unknown policy %s\n", name);
+    exit(2);
+}
+
+static inline void bench_init(struct bench *b, const char *name, sched_policy policy, int threads,
+                              int batches) {
+    b->name = name;
+    b->policy = policy;
+    b->threads = threads;
+    b->samples = malloc(batches * sizeof(double));
+    b->nsamples = 0;
+    b->capacity = batches;
+    b->total_ns = 0;
+    b->total_ops = 0;
+    if (b->samples == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+}
+
+static inline void bench_batch_begin(struct bench *b) {
+    b->start = bench_now();
+}
+
+// Ends a batch of the given number of operations
+static inline void bench_batch_end(struct bench *b, uint64_t ops) {
+    uint64_t ns = bench_now() - b->start;
+    if (ops == 0 || b->nsamples == b->capacity)
+        return;
+
+    b->samples[b->nsamples++] = (double) ns / ops;
+    b->total_ns += ns;
+    b->total_ops += ops;
+}
+
+static int bench_compare(const void *a, const void *b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static inline double bench_percentile(struct bench *b, double p) {
+    return b->samples[(int) (p * (b->nsamples - 1) + 0.5)];
+}
+
+static inline void bench_report(struct bench *b) {
+    if (b->nsamples == 0)
+        return;
+
+    qsort(b->samples, b->nsamples, sizeof(double), bench_compare);
+
+    printf("{\"bench\": \"%s\", \"policy\": \"%s\", \"threads\": %d, \"ops\": %ld, "
+           "\"ns_per_op\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+           "\"max\": %.1f}\n",
+           b->name, bench_policy_name(b->policy), b->threads, (long) b->total_ops,
+           (double) b->total_ns / b->total_ops,
+           bench_percentile(b, 0.5), bench_percentile(b, 0.9), bench_percentile(b, 0.99),
+           bench_percentile(b, 0.999), bench_percentile(b, 1.0));
+    fflush(stdout);
+
+    free(b->samples);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include "bench.h"
+
+// Measures the throughput of thread creation. In join mode the main thread
+// creates a thread and joins it; in detach mode it creates detached threads
+// in batches and yields until they have all run, so the cost of releasing
+// them is included. Spawn mode does the same with uthread_spawn(), batch
+// mode creates each batch with a single uthread_create_batch().
+//
+// usage: create_bench [policy] [join|detach|spawn|batch] [threads]
+
+#define BATCH 64
+
+struct bench b;
+long finished; // detached threads that have run
+
+void* noop(void *args) {
+    (void) args;
+    return NULL;
+}
+
+void* count(void *args) {
+    (void) args;
+    finished++;
+    return NULL;
+}
+
+static void bench_join(long batches) {
+    for (long i = 0; i < batches; i++) {
+        bench_batch_begin(&b);
+        for (int j = 0; j < BATCH; j++) {
+            uthread t;
+            if (uthread_create(&t, noop, NULL, 0) || uthread_join(t, NULL)) {
+                fprintf(stderr, "Error creating thread.\n");
+                exit(1);
+            }
+        }
+        bench_batch_end(&b, BATCH);
+    }
+}
+
+static void bench_detach(long batches, bool spawn) {
+    for (long i = 0; i < batches; i++) {
+        bench_batch_begin(&b);
+        for (int j = 0; j < BATCH; j++) {
+            uthread t;
+            if (spawn ? uthread_spawn(count, NULL)
+                      : uthread_create(&t, count, NULL, 0) || uthread_detach(t)) {
+                fprintf(stderr, "Error creating thread.\n");
+                exit(1);
+            }
+        }
+        while (finished < (i + 1) * BATCH)
+            uthread_yield();
+        bench_batch_end(&b, BATCH);
+    }
+}
+
+static void bench_create_batch(long batches) {
+    for (long i = 0; i < batches; i++) {
+        bench_batch_begin(&b);
+        if (uthread_create_batch(BATCH, NULL, count, NULL, 0)) {
+            fprintf(stderr, "Error creating threads.\n");
+            exit(1);
+        }
+        while (finished < (i + 1) * BATCH)
+            uthread_yield();
+        bench_batch_end(&b, BATCH);
+    }
+}
+
+int main(int argc, char **argv) {
+    sched_policy policy = argc > 1 ? bench_policy(argv[1]) : FIFO;
+    const char *mode = argc > 2 ? argv[2] : "join";
+    long threads = argc > 3 ? atol(argv[3]) : 200000;
+    long batches = threads / BATCH;
+
+    uthread_init(policy, DEFAULT_STACK_SIZE);
+
+    if (strcmp(mode, "join") == 0) {
+        bench_init(&b, "create_join", policy, 1, batches);
+        bench_join(batches);
+    } else if (strcmp(mode, "detach") == 0) {
+        bench_init(&b, "create_detach", policy, BATCH, batches);
+        bench_detach(batches, false);
+    } else if (strcmp(mode, "spawn") == 0) {
+        bench_init(&b, "create_spawn", policy, BATCH, batches);
+        bench_detach(batches, true);
+    } else if (strcmp(mode, "batch") == 0) {
+        bench_init(&b, "create_batch", policy, BATCH, batches);
+        bench_create_batch(batches);
+    } else {
+        fprintf(stderr, "usage: %s [policy] [join|detach|spawn|batch] [threads]\n", argv[0]);
+        return 2;
+    }
+
+    bench_report(&b);
+    return 0;
+}
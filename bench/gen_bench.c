@@ -0,0 +1,94 @@
+#include "bench.h"
+#include <uthread_gen.h>
+
+// Measures passing values between two threads without going through the
+// runqueue. In gen mode the main thread pulls values from a generator; in
+// yield_to mode two threads hand the CPU to each other with
+// uthread_yield_to() while the main thread waits in the runqueue. Each
+// operation is one value, i.e. two switches.
+//
+// usage: gen_bench [policy] [gen|yield_to] [values]
+
+#define BATCHES 1000
+
+struct bench b;
+uthread pair[2];
+long values_per_batch;
+volatile bool stop;
+
+void counter(void *args) {
+    (void) args;
+    long i = 0;
+    while (uthread_gen_yield((void*) i++) == 0)
+        ;
+}
+
+void* bouncer(void *args) {
+    (void) args;
+    while (!stop)
+        uthread_yield_to(pair[0]);
+    return NULL;
+}
+
+void* timer(void *args) {
+    (void) args;
+    for (int i = 0; i < BATCHES; i++) {
+        bench_batch_begin(&b);
+        for (long j = 0; j < values_per_batch; j++)
+            uthread_yield_to(pair[1]);
+        bench_batch_end(&b, values_per_batch);
+    }
+    stop = true;
+    return NULL;
+}
+
+static void bench_gen() {
+    uthread_gen gen = uthread_gen_create(counter, NULL);
+    if (gen == NULL) {
+        fprintf(stderr, "Error creating generator.\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < BATCHES; i++) {
+        bench_batch_begin(&b);
+        for (long j = 0; j < values_per_batch; j++)
+            uthread_gen_next(gen, NULL);
+        bench_batch_end(&b, values_per_batch);
+    }
+    uthread_gen_destroy(gen);
+}
+
+static void bench_yield_to() {
+    if (uthread_create(&pair[0], timer, NULL, 0) || uthread_create(&pair[1], bouncer, NULL, 0)) {
+        fprintf(stderr, "Error creating thread.\n");
+        exit(1);
+    }
+
+    uthread_join(pair[0], NULL);
+    uthread_join(pair[1], NULL);
+}
+
+int main(int argc, char **argv) {
+    sched_policy policy = argc > 1 ? bench_policy(argv[1]) : FIFO;
+    const char *mode = argc > 2 ? argv[2] : "gen";
+    long values = argc > 3 ? atol(argv[3]) : 1000000;
+    values_per_batch = values / BATCHES;
+    if (values_per_batch == 0)
+        values_per_batch = 1;
+
+    uthread_init(policy, DEFAULT_STACK_SIZE);
+
+    if (strcmp(mode, "gen") == 0) {
+        bench_init(&b, "gen_next", policy, 2, BATCHES);
+        bench_gen();
+    } else if (strcmp(mode, "yield_to") == 0) {
+        bench_init(&b, "yield_to", policy, 2, BATCHES);
+        bench_yield_to();
+    } else {
+        fprintf(stderr, "usage: %s [policy] [gen|yield_to] [values]\n", argv[0]);
+        return 2;
+    }
+
+    bench_report(&b);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "bench.h"
+
+// Measures the cost of uthread_yield() with a number of threads that all
+// yield in a loop. With 2 threads this is a ping-pong between them; with more
+// it shows how dispatch scales with the size of the runqueue.
+//
+// usage: yield_bench [policy] [threads] [yields]
+
+#define BATCHES 1000
+
+struct bench b;
+long yields_total; // yields by all threads so far
+long yields_per_batch;
+long yields_per_thread;
+
+void* yielder(void *args) {
+    (void) args;
+    for (long i = 0; i < yields_per_thread; i++) {
+        // whichever thread completes a batch starts the next one
+        if (yields_total % yields_per_batch == 0) {
+            if (yields_total > 0)
+                bench_batch_end(&b, yields_per_batch);
+            bench_batch_begin(&b);
+        }
+        yields_total++;
+        uthread_yield();
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    sched_policy policy = argc > 1 ? bench_policy(argv[1]) : FIFO;
+    int nthreads = argc > 2 ? atoi(argv[2]) : 2;
+    long yields = argc > 3 ? atol(argv[3]) : 2000000;
+    if (nthreads < 1) {
+        fprintf(stderr, "usage: %s [policy] [threads] [yields]\n", argv[0]);
+        return 2;
+    }
+    yields_per_thread = yields / nthreads;
+    yields_per_batch = yields_per_thread * nthreads / BATCHES;
+    if (yields_per_batch == 0)
+        yields_per_batch = 1;
+
+    uthread_init(policy, DEFAULT_STACK_SIZE);
+    bench_init(&b, nthreads == 2 ? "yield_pingpong" : "yield_runqueue", policy, nthreads, BATCHES);
+
+    uthread *threads = malloc(nthreads * sizeof(uthread));
+    if (threads == NULL)
+        return 1;
+    for (long i = 0; i < nthreads; i++) {
+        if (uthread_create(&threads[i], yielder, (void*) i, 0)) {
+            fprintf(stderr, "Error creating thread %ld.\n", i);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < nthreads; i++)
+        uthread_join(threads[i], NULL);
+
+    bench_report(&b);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <uthread.h>
+#include <uthread_chan.h>
+
+#define NUM_VALUES 10
+
+uthread_chan numbers, squares, done;
+
+void* generate(void *args) {
+    (void) args;
+    for (int i = 1; i <= NUM_VALUES; i++)
+        uthread_chan_send(numbers, &i);
+    uthread_chan_close(numbers);
+    return NULL;
+}
+
+void* square(void *args) {
+    (void) args;
+    int n;
+    while (uthread_chan_recv(numbers, &n) == 0) {
+        int sq = n * n;
+        uthread_chan_send(squares, &sq);
+    }
+    uthread_chan_close(squares);
+    return NULL;
+}
+
+void* print(void *args) {
+    (void) args;
+    int sq, total = 0;
+    while (uthread_chan_recv(squares, &sq) == 0) {
+        printf("%d\n", sq);
+        total += sq;
+    }
+    uthread_chan_send(done, &total);
+    return NULL;
+}
+
+int main() {
+    uthread thread1, thread2, thread3;
+
+    numbers = uthread_chan_create(sizeof(int), 0); // unbuffered
+    squares = uthread_chan_create(sizeof(int), 4); // buffered
+    done = uthread_chan_create(sizeof(int), 1);
+    if (numbers == NULL || squares == NULL || done == NULL) {
+        printf("Error creating channels.\n");
+        return 1;
+    }
+
+    if (uthread_create(&thread1, generate, NULL, 0) || uthread_create(&thread2, square, NULL, 0)
+            || uthread_create(&thread3, print, NULL, 0)) {
+        printf("Error creating threads.\n");
+        return 1;
+    }
+    uthread_detach(thread1);
+    uthread_detach(thread2);
+    uthread_detach(thread3);
+
+    // wait for the total, or report progress while the pipeline runs
+    int total;
+    struct uthread_chan_case cases[] = {
+        { done, UTHREAD_CHAN_RECV, &total, false },
+    };
+    while (uthread_chan_select(cases, 1, false) != 0) {
+        printf("waiting...\n");
+        uthread_sleep_ns(1000);
+    }
+    printf("Sum of squares: %d\n", total);
+
+    uthread_chan_destroy(numbers);
+    uthread_chan_destroy(squares);
+    uthread_chan_destroy(done);
+
+    return 0;
+}
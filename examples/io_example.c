@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <uthread.h>
+#include <uthread_io.h>
+
+#define NUM_MESSAGES 5
+
+int pipes[2][2];
+
+// Plain OS thread standing in for a slow peer
+void* producer(void *args) {
+    (void) args;
+    char msg[32];
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        usleep(100000);
+        int len = snprintf(msg, sizeof(msg), "message %d", i);
+        write(pipes[i % 2][1], msg, len);
+    }
+    close(pipes[0][1]);
+    close(pipes[1][1]);
+    return NULL;
+}
+
+void* reader(void *args) {
+    int n = *((int*) args);
+    char buf[32];
+    ssize_t len;
+    while ((len = uthread_read(pipes[n][0], buf, sizeof(buf) - 1)) > 0) {
+        buf[len] = '\0';
+        printf("reader %d: %s\n", n, buf);
+    }
+    printf("reader %d: done\n", n);
+    return NULL;
+}
+
+int main() {
+    uthread thread1, thread2;
+    int n1 = 0, n2 = 1;
+    pthread_t peer;
+
+    if (pipe(pipes[0]) || pipe(pipes[1])) {
+        printf("Error creating pipes.\n");
+        return 1;
+    }
+
+    int err = uthread_create(&thread1, reader, &n1, 0);
+    if (err) {
+        printf("Error creating thread1.\n");
+        return 1;
+    }
+
+    err = uthread_create(&thread2, reader, &n2, 0);
+    if (err) {
+        printf("Error creating thread2.\n");
+        return 1;
+    }
+
+    pthread_create(&peer, NULL, producer, NULL);
+
+    uthread_join(thread1, NULL);
+    uthread_join(thread2, NULL);
+    pthread_join(peer, NULL);
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <uthread.h>
+
+#define NUM_THREADS 16
+
+void* sum_range(void *args) {
+    long n = (long) args;
+    long sum = 0;
+    for (long i = 0; i < 50000000; i++) {
+        sum += i % (n + 1);
+        if (i % 1000000 == 0)
+            uthread_yield();
+    }
+    return (void*) sum;
+}
+
+int main() {
+    uthread threads[NUM_THREADS];
+
+    int err = uthread_init_workers(FIFO, DEFAULT_STACK_SIZE, 0);
+    if (err) {
+        printf("Error starting workers.\n");
+        return 1;
+    }
+
+    for (long i = 0; i < NUM_THREADS; i++) {
+        err = uthread_create(&threads[i], sum_range, (void*) i, 0);
+        if (err) {
+            printf("Error creating thread %ld.\n", i);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void *sum;
+        err = uthread_join(threads[i], &sum);
+        if (err) {
+            printf("Error joining thread %d.\n", i);
+            return 1;
+        }
+        printf("Thread %d: %ld\n", i, (long) sum);
+    }
+
+    return 0;
+}
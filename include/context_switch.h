@@ -1,6 +1,15 @@
 #ifndef CONTEXT_SWITCH_H
 #define CONTEXT_SWITCH_H
 
+// Saves the callee-saved registers (rbp, rbx, r12-r15), MXCSR and the x87
+// control word on the current stack, stores the stack pointer in *old_sp and
+// restores the same state from new_sp. MXCSR and the control word are only
+// reloaded if they differ from the current thread's.
+//
+// No vector register state is saved: XMM/YMM/ZMM registers are caller-saved
+// in the System V ABI, so no code relies on them across this call. A thread
+// preempted by a signal has its full vector state saved by the kernel in the
+// signal frame on its own stack, which is restored when it resumes.
 void context_switch(void **old_sp, void *new_sp);
 
-#endif
\ No newline at end of file
+#endif
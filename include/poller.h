@@ -0,0 +1,39 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// I/O Poller
+//
+// Parks threads until a file descriptor becomes ready. Each scheduler has its
+// own poller, an epoll instance shared by all of its workers. The scheduler
+// polls it when a worker runs out of ready threads, and periodically while
+// threads keep yielding. Waiting threads and their file descriptors are
+// protected by sched_lock.
+
+typedef struct poller *poller;
+
+// Creates the epoll instance and the eventfd behind poller_notify(). Returns
+// NULL on error.
+poller poller_create();
+void poller_destroy(poller p);
+
+// Makes a worker blocked in poller_poll() return, or the next poll return
+// immediately. Safe to call from any OS thread.
+void poller_notify(poller p);
+
+// Sleeps the current thread until fd reports any of the given epoll events
+// (or an error/hangup). Returns 0 once woken, -1 with errno set on error.
+int poller_wait(poller p, int fd, uint32_t events);
+
+// Waits up to timeout_ns (-1 for no limit) for ready file descriptors and
+// wakes their waiting threads. Returns the number of threads woken, or -1 if
+// another worker is already polling. Also used by idle workers to sleep until
+// the next timer expires.
+int poller_poll(poller p, int64_t timeout_ns);
+
+// Whether any thread is waiting for a file descriptor.
+bool poller_waiting(poller p);
+
+#endif
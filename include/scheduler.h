@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "thread.h"
+#include "uthread.h"
+#include "poller.h"
+#include <stdbool.h>
+
+// Scheduler internals shared between the library's source files. These are
+// not part of the public API. All of them act on the scheduler instance of
+// the calling OS thread.
+
+// Whether the calling OS thread has a scheduler: it initialized the library,
+// or is a worker of a scheduler that was.
+bool scheduler_initialized();
+
+sched_policy scheduler_policy();
+poller scheduler_poller();
+
+// Returns the thread running on the calling worker.
+struct thread *thread_current();
+
+// Switches to the next ready thread, leaving the current one in the given
+// state. With multiple workers, switching to SLP or ZMB requires sched_lock,
+// which is released once the switch is complete.
+void thread_switch(thread_state state);
+
+// Switches directly to thread t, bypassing the runqueue. t must be sleeping,
+// or ready and already taken off its runqueue. The current thread is left in
+// state RDY (and requeued) or SLP. If t is suspended, it is held off the CPU
+// instead and the next ready thread runs. Requires sched_lock with multiple
+// workers, which is released once the switch is complete.
+void thread_switch_to(struct thread *t, thread_state state);
+
+// Creates a detached thread that sleeps until it is woken or switched to.
+// Returns NULL if the thread limit is reached or memory runs out. Requires
+// sched_lock with multiple workers.
+struct thread *thread_new_detached(void* (*func)(void*), void *args);
+
+// Returns whether thread a is scheduled ahead of thread b under the current
+// policy: it has a higher priority under PS, less weighted CPU time under FAIR
+// or an earlier deadline under EDF. Always false under FIFO.
+bool thread_precedes(struct thread *a, struct thread *b);
+
+// Makes a sleeping thread ready. Requires sched_lock with multiple workers.
+void thread_wake(struct thread *t);
+
+// Protects thread state transitions when there are multiple workers. No-ops
+// with a single worker.
+void sched_lock_acquire();
+void sched_lock_release();
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdbool.h>
+#include <sched.h>
+
+// Test-and-test-and-set spinlock used to protect scheduler state when uthreads
+// run on more than one worker OS thread.
+
+typedef struct {
+    int locked;
+} spinlock;
+
+#define SPINLOCK_INIT { 0 }
+
+// Number of pause iterations before giving the OS thread's time slice away
+#define SPINLOCK_SPINS 1024
+
+static inline bool spinlock_trylock(spinlock *l) {
+    return !__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spinlock_lock(spinlock *l) {
+    while (!spinlock_trylock(l)) {
+        int spins = 0;
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED)) {
+            if (++spins < SPINLOCK_SPINS) {
+                __builtin_ia32_pause();
+            } else {
+                sched_yield(); // holder is likely descheduled
+                spins = 0;
+            }
+        }
+    }
+}
+
+static inline void spinlock_unlock(spinlock *l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+#endif
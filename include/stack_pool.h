@@ -0,0 +1,23 @@
+#ifndef STACK_POOL_H
+#define STACK_POOL_H
+
+#include <stddef.h>
+
+// Stack Pool
+//
+// Hands out fixed-size thread stacks reserved with mmap, each with a PROT_NONE
+// guard page below it so an overflow faults instead of corrupting memory.
+// Released stacks are cached and handed out again without any system call.
+
+typedef struct stack_pool *stack_pool;
+
+stack_pool stack_pool_create(size_t stack_size, int max_cached);
+void stack_pool_destroy(stack_pool pool);
+void* stack_pool_alloc(stack_pool pool);
+// Allocates n stacks at once, taking cached ones first and mapping the rest
+// together. Returns 0, or -1 with none allocated.
+int stack_pool_alloc_batch(stack_pool pool, void **stacks, int n);
+void stack_pool_free(stack_pool pool, void *stack);
+size_t stack_pool_stack_size(stack_pool pool);
+
+#endif
@@ -1,7 +1,13 @@
 #ifndef THREAD_H 
 #define THREAD_H    
 
-typedef int uthread;
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Thread handle: the low 32 bits index the thread table, the high bits hold
+// the generation of that slot so a stale handle never refers to a new thread.
+typedef int64_t uthread;
 
 typedef enum {
     RDY, // Ready
@@ -10,16 +16,58 @@ typedef enum {
     ZMB  // Zombie 
 } thread_state;
 
+#ifdef UTHREAD_STATS
+// Per-thread counters, see uthread_thread_stats(). Times are in TSC cycles.
+struct thread_stats {
+    uint64_t switches_in;
+    uint64_t voluntary;   // switched out by yielding
+    uint64_t preempted;   // switched out by the preemption timer
+    uint64_t blocking;    // switched out to sleep
+    uint64_t run_cycles;
+    uint64_t wait_cycles; // time spent ready but not running
+    uint64_t ready_since;
+};
+#endif
+
+#define CACHE_LINE 64
+
+// Thread control block. Threads created by the scheduler keep it at the top of
+// their stack mapping. Fields used on every dispatch come first and fill the
+// first cache line; the rest are only needed to start, join or inspect the
+// thread.
 struct thread {
-    uthread id;
-    void* stack_end;
+    // hot
     void* sp;
+    thread_state state;
+    int priority;
+    int64_t vruntime;     // weighted CPU time in TSC cycles, FAIR policy only
+    uint64_t deadline;    // absolute deadline, UTHREAD_NO_DEADLINE if none
+    struct thread *queue_next; // links in a thread_queue
+    struct thread *queue_prev;
+    struct thread_queue *queue; // queue the thread is on, NULL if none
+    int heap_index;       // position in a thread_heap
+    bool suspended;       // uthread_suspend() called and not yet resumed
+
+    // cold
     void* (*func)(void*);
     void* args;
     void* retval;
-    thread_state state;
-    int priority;
     uthread join_id;
-};
+    uthread id;
+    void* stack_end;      // lowest address of the stack mapping, NULL if none
+    int preempt_disabled; // nesting depth of uthread_preempt_disable()
+    bool preempt_pending; // preempted while disabled, yield on enable
+    bool held;            // kept off the runqueues while suspended
+    int last_worker;      // worker the thread last ran on, FAIR policy only
+    size_t stack_size;    // bytes of the stack mapping, which ends with this struct
+    size_t stack_hwm;     // bytes of it the previous thread on it used
+    bool stack_painted;   // stack below stack_hwm is filled with a canary
+    bool parked;          // sleeping in uthread_park()
+    bool unpark_permit;   // unparked while not parked, the next park returns
+    struct uthread_gen *gen; // generator whose body this thread runs, or NULL
+#ifdef UTHREAD_STATS
+    struct thread_stats stats;
+#endif
+} __attribute__((aligned(CACHE_LINE)));
 
 #endif
\ No newline at end of file
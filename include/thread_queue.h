@@ -4,25 +4,52 @@
 #include "thread.h"
 
 // Thread Queue
+//
+// Doubly linked list threaded through the queue_next and queue_prev fields of
+// struct thread, so no operation allocates and all of them take constant
+// time. A thread can be on at most one queue at a time.
 
 typedef struct thread_queue *thread_queue;
 
-thread_queue thread_queue_create(int capacity);
+thread_queue thread_queue_create();
 void thread_queue_destroy(thread_queue q);
-int thread_queue_enqueue(thread_queue q, struct thread *thread);
+void thread_queue_enqueue(thread_queue q, struct thread *thread);
 struct thread* thread_queue_dequeue(thread_queue q);
 struct thread* thread_queue_peek(thread_queue q);
+int thread_queue_remove(thread_queue q, struct thread *thread);
 int thread_queue_size(thread_queue q);
 
 // Thread Priority Queue
+//
+// One thread queue per priority level. Threads of equal priority are
+// dequeued in FIFO order. All operations take constant time.
 
 typedef struct thread_pqueue *thread_pqueue;
 
-thread_pqueue thread_pqueue_create(int capacity);
+thread_pqueue thread_pqueue_create();
 void thread_pqueue_destroy(thread_pqueue pq);
-int thread_pqueue_enqueue(thread_pqueue pq, struct thread *thread);
+void thread_pqueue_enqueue(thread_pqueue pq, struct thread *thread);
 struct thread* thread_pqueue_dequeue(thread_pqueue pq);
 struct thread* thread_pqueue_peek(thread_pqueue pq);
+int thread_pqueue_remove(thread_pqueue pq, struct thread *thread);
 int thread_pqueue_size(thread_pqueue pq);
 
+// Thread Heap
+//
+// Binary heap of threads, ordered so that extract returns a thread that no
+// other comes before. Each thread's position is kept in its heap_index, so a
+// thread can be removed in logarithmic time.
+
+typedef struct thread_heap *thread_heap;
+
+thread_heap thread_heap_create(int capacity, bool (*before)(struct thread*, struct thread*));
+void thread_heap_destroy(thread_heap h);
+int thread_heap_insert(thread_heap h, struct thread *thread);
+// Inserts n threads at once, rebuilding the heap if that is cheaper
+int thread_heap_insert_batch(thread_heap h, struct thread **threads, int n);
+struct thread* thread_heap_extract(thread_heap h);
+struct thread* thread_heap_peek(thread_heap h);
+int thread_heap_remove(thread_heap h, struct thread *thread);
+int thread_heap_size(thread_heap h);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timer Wheel
+//
+// Hierarchical timing wheel with 64 slots per level. Level l holds timers
+// expiring within 64^(l+1) ticks, each slot spanning 64^l ticks; its timers
+// cascade to lower levels as time advances. Adding and removing a timer is
+// O(1), and advancing skips empty slots using per-level occupancy bitmaps.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 11 // enough for any 64-bit tick
+
+// Intrusive timer, usually embedded in a structure on the waiter's stack
+struct timer {
+    uint64_t expires; // tick at which the timer fires
+    struct timer *next;
+    struct timer **pprev;
+    void *data;
+};
+
+typedef struct timer_wheel *timer_wheel;
+
+timer_wheel timer_wheel_create(uint64_t now);
+void timer_wheel_destroy(timer_wheel tw);
+
+// Adds a timer. Timers expiring at or before the current tick fire on the
+// next advance.
+void timer_wheel_add(timer_wheel tw, struct timer *t);
+void timer_wheel_remove(timer_wheel tw, struct timer *t);
+
+// Advances the wheel to tick now. Expired timers are removed and returned as
+// a list linked through next.
+struct timer* timer_wheel_advance(timer_wheel tw, uint64_t now);
+
+// Returns a lower bound on the earliest expiry (exact within 64 ticks of the
+// current tick), or UINT64_MAX if no timer is pending.
+uint64_t timer_wheel_next(timer_wheel tw);
+
+int timer_wheel_size(timer_wheel tw);
+
+#endif
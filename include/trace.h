@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "thread.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Trace Ring
+//
+// Fixed-size ring of scheduler events with TSC timestamps. Each worker writes
+// only its own ring, so recording an event is a few plain stores. When the
+// ring is full the oldest events are overwritten.
+
+typedef enum {
+    TRACE_CREATE, // thread created by arg
+    TRACE_SWITCH, // worker switched from thread arg to thread
+    TRACE_WAKE,   // thread made ready by arg
+    TRACE_EXIT,   // thread exited
+    TRACE_REAP    // thread's resources released
+} trace_event_type;
+
+struct trace_event {
+    uint64_t tsc;
+    uthread thread;
+    uthread arg;
+    uint64_t type;
+};
+
+struct trace_ring {
+    struct trace_event *events;
+    uint64_t mask; // capacity - 1, capacity is a power of two
+    uint64_t head; // events ever recorded
+};
+
+// Creates a ring holding at least capacity events
+struct trace_ring *trace_ring_create(size_t capacity);
+void trace_ring_destroy(struct trace_ring *r);
+
+static inline void trace_ring_record(struct trace_ring *r, trace_event_type type, uthread thread,
+                                     uthread arg) {
+    struct trace_event *e = &r->events[r->head & r->mask];
+    e->tsc = __builtin_ia32_rdtsc();
+    e->thread = thread;
+    e->arg = arg;
+    e->type = type;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+// Conversion of TSC timestamps to microseconds since the trace started
+struct trace_clock {
+    uint64_t start_tsc;
+    double us_per_cycle;
+};
+
+// Writes the ring's events as Chrome trace events (without the enclosing
+// array) on the track of the given worker. Running threads become complete
+// ("X") events spanning the time between switches, everything else an
+// instant event. first tells whether no event has been written to the array
+// yet, and is updated.
+void trace_ring_write_json(FILE *f, struct trace_ring *r, int worker, struct trace_clock *clock,
+                           bool *first);
+
+#endif
@@ -1,176 +1,798 @@
- /**
- * @file uthread.h
- * @brief Lightweight user-level thread library for Linux/x86
- * 
- * This library provides lightweight, cooperatively-scheduled user-level
- * threads (uthreads) that run within a single OS process and thread.
- * 
- * Threads must explicitly give up the CPU via uthread_yield(), uthread_join(),
- * or uthread_exit(). There is no preemption, so a running thread cannot be
- * interrupted by the scheduler.
- * 
- * The following scheduling policies are supported:
- * 
- *  - First-In, First-Out (FIFO): Threads run in creation order. A yielding
- *     thread is added at the end of the runqueue.
- *  - Priority Scheduling (PS): Threads run in order of priority (higher first).
- *     Ties are resolved non-deterministically. Note: A running thread is not
- *     preempted if a higher-priority thread becomes ready.
- * 
- * Because scheduling is cooperative and all threads share a single CPU core,
- * this library does not provide synchronization primitives (mutexes,
- * semaphores, etc.). Users must ensure threads do not yield while inside a
- * critical section to prevent race conditions.
- * 
- * @author Raimi Misalucha
- */
-
-#ifndef UTHREAD_H 
-#define UTHREAD_H    
-
-#include "thread.h"
-#include <stdlib.h>
-#include <stdbool.h>
-
-// Maximum number of concurrent threads
-#define MAX_THREADS 64
-
-// Default stack size per thread (64KB)
-#define DEFAULT_STACK_SIZE 65536
-
-// Default scheduling policy if uthread_init() is not called explicitly
-#define DEFAULT_SCHEDULING_POLICY FIFO
-
-// Maximum and minimum priorities of threads
-#define MAX_PRIORITY 20
-#define MIN_PRIORITY -20
-
-typedef enum {
-    FIFO, // First-In-First-Out
-    PS    // Priority Scheduling 
-} sched_policy;
-
-/**
- * @brief Initializes the uthread library with specified parameters.
- * 
- * This function must be called before creating any threads to set a non-default
- * scheduling policy or stack size. If not called explicitly, the first call to
- * uthread_create() will initialize with defaults.
- * 
- * Only the first call to this function sets paramaters, so it should not be
- * called multiple times.
- * 
- * @param policy Scheduling policy to use (FIFO or PS).
- * @param stack_sz Stack size in bytes for each thread.
- * 
- * @warning Once initialized, the scheduling policy and stack size are fixed.
- */
-void uthread_init(sched_policy policy, size_t stack_sz);
-
-/**
- * @brief Creates a new thread.
- * 
- * Creates a new thread that will execute the given function with the provided
- * arguments. The new thread is immediately added to the runqueue and will
- * run according to the current scheduling policy.
- * 
- * @param[out] thread Pointer to store the new thread's ID. Cannot be NULL.
- * @param[in] func Function to execute in the new thread.
- * @param[in] args Argument to pass to func. Can be NULL.
- * @param[in] priority Priority of new thread. Only has effect for priority
- *                     scheduling. Must be in range [MIN_PRIORITY, MAX_PRIORITY].
- * 
- * @return 0 on success, -1 on error
- * 
- * @retval 0 Success: thread created and scheduled
- * @retval -1 Error occurred:
- *            - thread pointer is NULL
- *            - Maximum thread limit (MAX_THREADS) reached
- *            - Invalid priority
- *            - Memory allocation failed
- * 
- * @note If uthread_init() was not called, this function initializes with defaults.
- */
-int uthread_create(uthread *thread, void* (*func)(void*), void *args, int priority);
-
-/**
- * @brief Waits for a thread to terminate and collect its return value.
- * 
- * Blocks the calling thread until the specified thread terminates. The joined
- * thread's resources are released after this call. A thread can only be joined
- * once.
- * 
- * @param[in] utid ID of the thread to join
- * @param[out] retval Pointer to store the joined thread's return value.
- *                    May be NULL if return value is not needed.
- * 
- * @return 0 on success, -1 on error
- * 
- * @retval 0 Success: thread joined and cleaned up
- * @retval -1 Error occurred:
- *            - Invalid thread ID
- *            - Thread does not exist
- *            - Thread is detached
- *            - Thread is already being joined by another thread
- * 
- * @warning Joining a thread that is already joined or detached is an error.
- * 
- * @note The calling thread cannot run until the joined thread terminates.
- */
-int uthread_join(uthread utid, void **retval);
-
-/**
- * @brief Terminates the calling thread with a return value.
- * 
- * Causes the calling thread to exit immediately. The return value can be
- * collected by another thread via uthread_join(). This function is implicitly
- * called when a thread function returns normally.
- * 
- * @param[in] retval Return value to provide to joining thread. Can be NULL.
- * 
- * @note This function does not return to the caller.
- * @note If called from the main thread, the entire program is terminated. 
- * @note If the thread is being joined, the joining thread is awakened.
- * @note If the thread is detached, resources are automatically released.
- */
-void uthread_exit(void *retval);
-
-/**
- * @brief Detaches a thread so its resources are automatically released upon
- * termination.
- * 
- * Marks the specified thread as detached. When a detached thread terminates,
- * its resources are automatically released. A detached thread cannot be joined.
- * 
- * @param[in] utid ID of the thread to detach
- * 
- * @return 0 on success, -1 on error
- * 
- * @retval 0 Success: thread detached
- * @retval -1 Error occurred:
- *            - Invalid thread ID
- *            - Thread does not exist
- *            - Thread is already detached
- *            - Thread is already being joined
- * 
- * @warning Once a thread is detached, its return value cannot be retrieved.
- */
-int uthread_detach(uthread utid);
-
-/**
- * @brief Voluntarily yields the CPU to the next scheduled thread.
- * 
- * Causes the calling thread to give up the CPU and be placed back in the
- * runqueue according to the scheduling policy. The next thread in the runqueue
- * will be selected to run.
- * 
- * @note This is the primary mechanism for cooperative scheduling. Threads
- *       should call this periodically to allow other threads to run.
- * 
- * @note If the runqueue is empty, execution stays with the calling thread.
- * 
- * @warning Running threads that don't yield will starve other threads.
- */
-void uthread_yield();
-
-#endif
\ No newline at end of file
+ /**
+ * @file uthread.h
+ * @brief Lightweight user-level thread library for Linux/x86
+ * 
+ * This library provides lightweight, cooperatively-scheduled user-level
+ * threads (uthreads) that run within a single OS process and thread.
+ * Optionally, uthread_init_workers() runs uthreads across several worker OS
+ * threads (M:N scheduling), each with its own runqueue. Idle workers steal
+ * ready threads from the other workers' runqueues.
+ * 
+ * Each OS thread that initializes the library gets a scheduler of its own,
+ * with its own policy, stack size, threads and workers. Schedulers share no
+ * state, so the functions below act on the calling OS thread's scheduler, and
+ * thread IDs, channels and synchronization objects must not be passed between
+ * schedulers.
+ * 
+ * Threads must explicitly give up the CPU via uthread_yield(), uthread_join(),
+ * or uthread_exit(). By default there is no preemption, so a running thread
+ * cannot be interrupted by the scheduler; uthread_set_preemption() enables
+ * optional time slicing.
+ * 
+ * The following scheduling policies are supported:
+ * 
+ *  - First-In, First-Out (FIFO): Threads run in creation order. A yielding
+ *     thread is added at the end of the runqueue.
+ *  - Priority Scheduling (PS): Threads run in order of priority (higher first).
+ *     Threads of equal priority run in FIFO order, so they take turns when
+ *     yielding. Note: A running thread is not preempted if a higher-priority
+ *     thread becomes ready.
+ *  - Fair-share Scheduling (FAIR): Each thread's CPU time is accounted at every
+ *     context switch and scaled by a weight derived from its priority. The
+ *     thread that has received the least weighted CPU time runs next, so
+ *     threads share the CPU in proportion to their weights (about 1.25x per
+ *     priority step) and no thread starves. A woken thread is only credited
+ *     with a little of the time it spent sleeping.
+ *  - Earliest Deadline First (EDF): The ready thread with the earliest
+ *     deadline runs next (see uthread_create_deadline() and
+ *     uthread_set_deadline()). Threads without a deadline run only when no
+ *     thread with one is ready. Ties are resolved non-deterministically.
+ * 
+ * Blocking system calls stall every thread on the same worker. uthread_io.h
+ * provides I/O functions that sleep only the calling thread instead.
+ * 
+ * With a single worker, scheduling is cooperative and only one thread runs at
+ * a time, so a critical section that does not yield needs no locking (unless
+ * preemption is enabled, see uthread_preempt_disable()). With multiple workers
+ * threads run in parallel on several CPU cores, so all shared data needs the
+ * mutexes, condition variables and semaphores of uthread_sync.h, as do
+ * critical sections that yield in either case. These put waiting threads to
+ * sleep instead of spinning.
+ * 
+ * @author Raimi Misalucha
+ */
+
+#ifndef UTHREAD_H 
+#define UTHREAD_H    
+
+#include "thread.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Maximum number of concurrent threads. The thread table and runqueues grow on
+// demand up to this limit.
+#define MAX_THREADS (1 << 24)
+
+// Default stack size per thread (64KB)
+#define DEFAULT_STACK_SIZE 65536
+
+// Default scheduling policy if uthread_init() is not called explicitly
+#define DEFAULT_SCHEDULING_POLICY FIFO
+
+// Maximum and minimum priorities of threads
+#define MAX_PRIORITY 20
+#define MIN_PRIORITY -20
+
+// Deadline of threads that have none, later than any other
+#define UTHREAD_NO_DEADLINE UINT64_MAX
+
+// Number of waiters to pass to uthread_wake_addr() to wake all of them
+#define UTHREAD_WAKE_ALL INT32_MAX
+
+// Scheduler counters summed over all workers, see uthread_stats()
+struct uthread_stats {
+    uint64_t context_switches;   // switches to a thread
+    uint64_t voluntary_switches; // switches away from a yielding thread
+    uint64_t preemptions;        // switches forced by the preemption timer
+    uint64_t blocking_switches;  // switches away from a thread that went to sleep
+    uint64_t steals;             // threads taken from another worker's runqueue
+    uint64_t parks;              // times a worker blocked waiting for work
+    uint64_t threads_created;
+    uint64_t threads_exited;
+    unsigned threads;            // threads currently existing
+};
+
+// Counters of a single thread, see uthread_thread_stats()
+struct uthread_thread_stats {
+    uint64_t switches_in;  // times the thread was switched to
+    uint64_t switches_out; // voluntary + preempted + blocking
+    uint64_t voluntary;    // switched out by yielding
+    uint64_t preempted;    // switched out by the preemption timer
+    uint64_t blocking;     // switched out to sleep (join, I/O, timers, sync)
+    uint64_t run_ns;       // time spent running
+    uint64_t wait_ns;      // time spent ready in a runqueue
+};
+
+typedef enum {
+    FIFO, // First-In-First-Out
+    PS,   // Priority Scheduling 
+    FAIR, // Fair-share Scheduling
+    EDF   // Earliest Deadline First
+} sched_policy;
+
+/**
+ * @brief Initializes the uthread library with specified parameters.
+ * 
+ * This function must be called before creating any threads to set a non-default
+ * scheduling policy or stack size. If not called explicitly, the first call to
+ * uthread_create() will initialize with defaults.
+ * 
+ * Initializes a scheduler for the calling OS thread, independent of those of
+ * other OS threads. Only the first call on an OS thread sets paramaters, so it
+ * should not be called multiple times.
+ * 
+ * @param policy Scheduling policy to use (FIFO, PS, FAIR or EDF).
+ * @param stack_sz Stack size in bytes for each thread. Rounded up to a whole
+ *                 number of pages. The thread's control block (a few hundred
+ *                 bytes) is kept at the top of this space.
+ * 
+ * @note Each stack is preceded by an inaccessible guard page, so a thread that
+ *       overflows its stack is terminated with SIGSEGV.
+ * @note If the scheduler cannot be set up, e.g. when out of memory, the
+ *       process is aborted. Use uthread_init_workers() with one worker to get
+ *       an error instead.
+ * 
+ * @warning Once initialized, the scheduling policy and stack size are fixed.
+ */
+void uthread_init(sched_policy policy, size_t stack_sz);
+
+/**
+ * @brief Initializes the uthread library to run threads on multiple worker OS
+ * threads.
+ * 
+ * Behaves like uthread_init(), but additionally starts nworkers - 1 worker OS
+ * threads. The calling OS thread acts as the first worker and keeps running
+ * the main thread. Each worker has its own runqueue: newly created and woken
+ * threads are queued on the worker that created or woke them, and a worker
+ * whose runqueue is empty steals ready threads from the other workers.
+ * 
+ * The semantics of uthread_create(), uthread_join(), uthread_detach(),
+ * uthread_exit() and uthread_yield() are unchanged, but a thread may resume on
+ * a different OS thread after any of them.
+ * 
+ * @param policy Scheduling policy to use (FIFO, PS, FAIR or EDF). Applies to each
+ *               worker's runqueue.
+ * @param stack_sz Stack size in bytes for each thread.
+ * @param nworkers Number of worker OS threads. If 0 or negative, one worker
+ *                 per online CPU is used.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: library initialized and workers started
+ * @retval -1 Error occurred:
+ *            - Library is already initialized on the calling OS thread
+ *            - Memory allocation failed
+ *            - A worker OS thread could not be created
+ * 
+ * @warning Once initialized, the number of workers is fixed.
+ * @warning If the calling OS thread is not the process's main thread, its
+ *          start routine must not return, since it may by then be running
+ *          on another worker's OS thread.
+ */
+int uthread_init_workers(sched_policy policy, size_t stack_sz, int nworkers);
+
+/**
+ * @brief Creates a new thread.
+ * 
+ * Creates a new thread that will execute the given function with the provided
+ * arguments. The new thread is immediately added to the runqueue and will
+ * run according to the current scheduling policy.
+ * 
+ * @param[out] thread Pointer to store the new thread's ID. Cannot be NULL. IDs
+ *                    of terminated threads may be reused, but never compare
+ *                    equal to the ID of the thread that previously held them.
+ * @param[in] func Function to execute in the new thread.
+ * @param[in] args Argument to pass to func. Can be NULL.
+ * @param[in] priority Priority of new thread. Only has effect for priority
+ *                     and fair-share scheduling. Must be in range
+ *                     [MIN_PRIORITY, MAX_PRIORITY].
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: thread created and scheduled
+ * @retval -1 Error occurred:
+ *            - thread pointer is NULL
+ *            - Maximum thread limit (MAX_THREADS) reached
+ *            - Invalid priority
+ *            - Memory allocation failed
+ * 
+ * @note If uthread_init() was not called, this function initializes with defaults.
+ */
+int uthread_create(uthread *thread, void* (*func)(void*), void *args, int priority);
+
+/**
+ * @brief Creates a new thread with a deadline.
+ * 
+ * Like uthread_create(), but the new thread has priority 0 and must finish by
+ * the given time. Under EDF, ready threads run in order of their deadlines.
+ * Under the other policies the deadline only counts towards
+ * uthread_deadline_misses().
+ * 
+ * @param[out] thread Pointer to store the new thread's ID. Cannot be NULL.
+ * @param[in] func Function to execute in the new thread.
+ * @param[in] args Argument to pass to func. Can be NULL.
+ * @param[in] deadline_ns Absolute deadline, as returned by uthread_now_ns(),
+ *                        or UTHREAD_NO_DEADLINE.
+ * 
+ * @return 0 on success, -1 on error (see uthread_create())
+ */
+int uthread_create_deadline(uthread *thread, void* (*func)(void*), void *args, uint64_t deadline_ns);
+
+/**
+ * @brief Creates a new thread with its own stack size.
+ * 
+ * Like uthread_create(), but the thread's stack has the given size instead of
+ * the one set by uthread_init(). Stacks of other sizes than the default are
+ * allocated in power-of-two numbers of pages, so threads with small stacks
+ * cost less memory.
+ * 
+ * @param[out] thread Pointer to store the new thread's ID. Cannot be NULL.
+ * @param[in] func Function to execute in the new thread.
+ * @param[in] args Argument to pass to func. Can be NULL.
+ * @param[in] priority Priority of new thread (see uthread_create())
+ * @param[in] stack_sz Stack size in bytes, rounded up as described above. If
+ *                     0, the default size (or under adaptive sizing, see
+ *                     uthread_set_adaptive_stacks(), the size for func) is
+ *                     used.
+ * 
+ * @return 0 on success, -1 on error (see uthread_create(), or stack_sz is too
+ *         large)
+ * 
+ * @warning The thread's control block and, if it is preempted, a signal frame
+ *          of a few kilobytes are kept on its stack as well.
+ */
+int uthread_create_stack(uthread *thread, void* (*func)(void*), void *args, int priority,
+                         size_t stack_sz);
+
+/**
+ * @brief Creates a number of threads at once.
+ * 
+ * Like calling uthread_create() n times, but the threads and their stacks are
+ * allocated together, their IDs reserved together and all of them added to
+ * the runqueue in one step, which is considerably cheaper for large fan-outs.
+ * Either all threads are created or none.
+ * 
+ * @param[in] n Number of threads to create
+ * @param[out] ids Array of n elements receiving the new threads' IDs, in the
+ *                 order of args. If NULL, the threads are created detached as
+ *                 with uthread_spawn().
+ * @param[in] func Function every new thread executes
+ * @param[in] args Array of n arguments, one passed to each thread's func. If
+ *                 NULL, every thread gets NULL.
+ * @param[in] priority Priority of the new threads (see uthread_create())
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: all threads created and scheduled
+ * @retval -1 Error occurred, no thread was created:
+ *            - n is negative
+ *            - Maximum thread limit (MAX_THREADS) reached
+ *            - Invalid priority
+ *            - Memory allocation failed
+ * 
+ * @note If uthread_init() was not called, this function initializes with defaults.
+ */
+int uthread_create_batch(int n, uthread *ids, void* (*func)(void*), void **args, int priority);
+
+/**
+ * @brief Creates a detached thread for fire-and-forget work.
+ * 
+ * Like uthread_create() with priority 0 followed by uthread_detach(), but
+ * without taking the scheduler lock twice or returning an ID. The thread's
+ * resources are released as soon as it terminates.
+ * 
+ * @param[in] func Function to execute in the new thread. Its return value is
+ *                 discarded.
+ * @param[in] args Argument to pass to func. Can be NULL.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: thread created and scheduled
+ * @retval -1 Error occurred:
+ *            - Maximum thread limit (MAX_THREADS) reached
+ *            - Memory allocation failed
+ * 
+ * @note Terminated threads are kept with their stacks and reused by later
+ *       calls to this function and uthread_create(), so creating threads at a
+ *       high rate does not allocate memory.
+ */
+int uthread_spawn(void* (*func)(void*), void *args);
+
+/**
+ * @brief Waits for a thread to terminate and collect its return value.
+ * 
+ * Blocks the calling thread until the specified thread terminates. The joined
+ * thread's resources are released after this call. A thread can only be joined
+ * once.
+ * 
+ * @param[in] utid ID of the thread to join
+ * @param[out] retval Pointer to store the joined thread's return value.
+ *                    May be NULL if return value is not needed.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: thread joined and cleaned up
+ * @retval -1 Error occurred:
+ *            - Invalid thread ID
+ *            - Thread does not exist or has already been released
+ *            - Thread is detached
+ *            - Thread is already being joined by another thread
+ * 
+ * @warning Joining a thread that is already joined or detached is an error.
+ * 
+ * @note The calling thread cannot run until the joined thread terminates.
+ */
+int uthread_join(uthread utid, void **retval);
+
+/**
+ * @brief Terminates the calling thread with a return value.
+ * 
+ * Causes the calling thread to exit immediately. The return value can be
+ * collected by another thread via uthread_join(). This function is implicitly
+ * called when a thread function returns normally.
+ * 
+ * @param[in] retval Return value to provide to joining thread. Can be NULL.
+ * 
+ * @note This function does not return to the caller.
+ * @note If called from the main thread, the entire program is terminated. 
+ * @note If the thread is being joined, the joining thread is awakened.
+ * @note If the thread is detached, resources are automatically released.
+ */
+void uthread_exit(void *retval);
+
+/**
+ * @brief Detaches a thread so its resources are automatically released upon
+ * termination.
+ * 
+ * Marks the specified thread as detached. When a detached thread terminates,
+ * its resources are automatically released. A detached thread cannot be joined.
+ * 
+ * @param[in] utid ID of the thread to detach
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: thread detached
+ * @retval -1 Error occurred:
+ *            - Invalid thread ID
+ *            - Thread does not exist or has already been released
+ *            - Thread is already detached
+ *            - Thread is already being joined
+ * 
+ * @warning Once a thread is detached, its return value cannot be retrieved.
+ */
+int uthread_detach(uthread utid);
+
+/**
+ * @brief Voluntarily yields the CPU to the next scheduled thread.
+ * 
+ * Causes the calling thread to give up the CPU and be placed back in the
+ * runqueue according to the scheduling policy. The next thread in the runqueue
+ * will be selected to run.
+ * 
+ * @note This is the primary mechanism for cooperative scheduling. Threads
+ *       should call this periodically to allow other threads to run.
+ * 
+ * @note If the runqueue is empty, execution stays with the calling thread.
+ * 
+ * @warning Running threads that don't yield will starve other threads.
+ */
+void uthread_yield();
+
+/**
+ * @brief Yields the CPU directly to a specific thread.
+ *
+ * If the thread is ready, it is taken off its runqueue and switched to
+ * immediately, ahead of any other ready thread and whatever the scheduling
+ * policy. The calling thread is placed back in the runqueue as by
+ * uthread_yield(). If the thread is blocked or already running, this behaves
+ * like uthread_yield().
+ *
+ * @param[in] utid ID of the thread to run next
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @retval 0 Success: yielded
+ * @retval -1 Error occurred, the calling thread keeps running:
+ *            - Invalid thread ID or thread has terminated
+ */
+int uthread_yield_to(uthread utid);
+
+/**
+ * @brief Changes the priority of a thread.
+ * 
+ * A ready thread is moved to the position of its new priority in the
+ * runqueue, behind the threads already waiting at that priority. The new
+ * priority of a sleeping thread takes effect when it is woken.
+ * 
+ * @param[in] utid ID of the thread, which may be the calling thread
+ * @param[in] priority New priority. Only has effect for priority and
+ *                     fair-share scheduling. Must be in range
+ *                     [MIN_PRIORITY, MAX_PRIORITY].
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: priority changed
+ * @retval -1 Error occurred:
+ *            - Invalid priority
+ *            - Invalid thread ID
+ *            - Thread does not exist or has terminated
+ * 
+ * @note The calling thread keeps running even if a ready thread now has a
+ *       higher priority.
+ * @note Takes constant time under PS and logarithmic time under FAIR.
+ */
+int uthread_set_priority(uthread utid, int priority);
+
+/**
+ * @brief Changes the deadline of a thread.
+ * 
+ * A ready thread is moved to the position of its new deadline in the
+ * runqueue. A thread that handles a sequence of requests can set a new
+ * deadline for each of them.
+ * 
+ * @param[in] utid ID of the thread, which may be the calling thread
+ * @param[in] deadline_ns New absolute deadline, as returned by
+ *                        uthread_now_ns(), or UTHREAD_NO_DEADLINE.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: deadline changed
+ * @retval -1 Error occurred:
+ *            - Invalid thread ID
+ *            - Thread does not exist or has terminated
+ * 
+ * @note If the previous deadline has already passed, it counts as a miss.
+ * @note The calling thread keeps running even if a ready thread now has an
+ *       earlier deadline.
+ */
+int uthread_set_deadline(uthread utid, uint64_t deadline_ns);
+
+/**
+ * @brief Suspends a thread until uthread_resume() is called on it.
+ * 
+ * A ready thread is taken off its runqueue, and the calling thread sleeps
+ * right away. A thread that is sleeping, e.g. on a mutex or I/O, still
+ * completes its wait but is not run until it is resumed. Suspending a
+ * suspended thread has no further effect; suspensions do not nest.
+ * 
+ * @param[in] utid ID of the thread, which may be the calling thread
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: thread suspended
+ * @retval -1 Error occurred:
+ *            - Library not initialized
+ *            - Invalid thread ID
+ *            - Thread does not exist or has terminated
+ * 
+ * @note With multiple workers, a thread running on another worker is
+ *       suspended once it next gives up the CPU.
+ * @warning A suspended thread keeps any mutex it holds.
+ */
+int uthread_suspend(uthread utid);
+
+/**
+ * @brief Resumes a suspended thread.
+ * 
+ * If the thread was kept from running, it is made ready again. Resuming a
+ * thread that is not suspended has no effect.
+ * 
+ * @param[in] utid ID of the thread
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: thread resumed, or was not suspended
+ * @retval -1 Error occurred:
+ *            - Library not initialized
+ *            - Invalid thread ID
+ *            - Thread does not exist or has terminated
+ */
+int uthread_resume(uthread utid);
+
+/**
+ * @brief Returns the number of missed deadlines.
+ * 
+ * A deadline is missed when a thread exits after it, or when it is replaced
+ * by uthread_set_deadline() after it has passed. Counted under every policy.
+ * 
+ * @return Number of deadlines missed since the library was initialized
+ */
+uint64_t uthread_deadline_misses();
+
+/**
+ * @brief Returns the current time of the clock used by the sleep functions.
+ * 
+ * @return Nanoseconds of CLOCK_MONOTONIC
+ */
+uint64_t uthread_now_ns();
+
+/**
+ * @brief Puts the calling thread to sleep for at least the given duration.
+ * 
+ * The thread does not consume CPU time while sleeping: other threads run in
+ * the meantime, and if no thread is ready the scheduler blocks the worker
+ * until the earliest sleeping thread is due. Timers have microsecond
+ * resolution and never expire early.
+ * 
+ * @param[in] ns Duration to sleep in nanoseconds. 0 is equivalent to
+ *               uthread_yield().
+ */
+void uthread_sleep_ns(uint64_t ns);
+
+/**
+ * @brief Puts the calling thread to sleep until an absolute time.
+ * 
+ * Like uthread_sleep_ns(), but wakes at a deadline rather than after a
+ * duration, so periodic threads do not accumulate drift.
+ * 
+ * @param[in] deadline_ns Time to wake up, as returned by uthread_now_ns().
+ *                        Returns immediately if it has already passed.
+ */
+void uthread_sleep_until(uint64_t deadline_ns);
+
+/**
+ * @brief Puts the calling thread to sleep while a word in memory holds a
+ * given value.
+ * 
+ * Building block for custom synchronization, like the futex system call:
+ * the calling thread sleeps until another thread calls uthread_wake_addr()
+ * on the same address. The value is checked atomically with respect to
+ * wakers, so a thread that changes *addr and then wakes the address never
+ * misses a waiter that saw the old value.
+ * 
+ * @param[in] addr Address of the word to wait on
+ * @param[in] expected Value *addr must hold for the thread to sleep
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: the thread slept and was woken
+ * @retval -1 Error occurred:
+ *            - *addr did not hold expected, the thread did not sleep
+ *            - addr is NULL
+ * 
+ * @note A woken thread should check *addr again: it may have changed once
+ *       more before the thread runs.
+ * 
+ * @note If the library is not initialized, it is initialized with defaults.
+ */
+int uthread_wait_on(const uint32_t *addr, uint32_t expected);
+
+/**
+ * @brief Wakes threads sleeping in uthread_wait_on() on an address.
+ * 
+ * Waiters are woken in the order they went to sleep, whatever the
+ * scheduling policy.
+ * 
+ * @param[in] addr Address the threads wait on
+ * @param[in] n Maximum number of threads to wake, UTHREAD_WAKE_ALL for all
+ * 
+ * @return Number of threads woken
+ */
+int uthread_wake_addr(const uint32_t *addr, int n);
+
+/**
+ * @brief Sleeps the calling thread until another thread unparks it.
+ *
+ * Returns immediately, consuming the permit, if uthread_unpark() was called
+ * for this thread since it last parked. A thread waiting for work from an OS
+ * thread outside the library should park until that thread unparks it.
+ *
+ * @note While any thread is parked, a worker that runs out of ready threads
+ *       sleeps until it is unparked instead of reporting a deadlock.
+ */
+void uthread_park();
+
+/**
+ * @brief Wakes a thread sleeping in uthread_park().
+ *
+ * If the thread is not parked, its next uthread_park() returns immediately.
+ * Unlike the other functions, this may be called from any OS thread, not only
+ * from threads of this library.
+ *
+ * @param[in] utid ID of the thread to unpark
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @retval 0 Success: thread woken, permit set, or request queued
+ * @retval -1 Error occurred:
+ *            - Library not initialized
+ *            - Invalid thread ID or thread has terminated
+ *            - Memory allocation failed
+ *
+ * @note Called from a foreign OS thread, the request is queued for the
+ *       workers of the first scheduler initialized in the process, and an
+ *       invalid thread ID is not reported.
+ */
+int uthread_unpark(uthread utid);
+
+/**
+ * @brief Creates a detached thread, from any OS thread.
+ *
+ * Like uthread_spawn(), but may also be called from OS threads outside the
+ * library. Their requests are queued for the workers of the first scheduler
+ * initialized in the process, which create the threads the next time they
+ * schedule, in the order they were submitted.
+ *
+ * @param[in] func Function the thread will execute
+ * @param[in] args Argument to pass to func. Can be NULL.
+ *
+ * @return 0 on success, -1 on error
+ *
+ * @retval 0 Success: thread created, or request queued
+ * @retval -1 Error occurred:
+ *            - Library not initialized or func is NULL
+ *            - Maximum thread limit (MAX_THREADS) reached
+ *            - Memory allocation failed
+ *
+ * @note Called from a foreign OS thread, failing to create the thread later
+ *       is not reported.
+ */
+int uthread_submit(void* (*func)(void*), void *args);
+
+/**
+ * @brief Enables or disables profiling of stack use.
+ * 
+ * While enabled, the stacks of newly created threads are filled with a
+ * canary pattern. How deep a thread used its stack is then available from
+ * uthread_stack_usage() while it exists, and when it is released, the
+ * deepest use of each entry function is recorded for uthread_stack_max().
+ * 
+ * @param enable Whether to profile threads created from now on
+ * 
+ * @note Painting touches every page of a stack, so profiled threads cost
+ *       their full stack size in memory. A released stack is only painted
+ *       again down to the depth its previous thread used.
+ * @note Disabling profiling also disables adaptive stack sizing.
+ */
+void uthread_set_stack_profiling(bool enable);
+
+/**
+ * @brief Enables or disables adaptive stack sizing.
+ * 
+ * While enabled, threads created without an explicit stack size get a stack
+ * of twice the deepest use profiled for their entry function, rounded up to
+ * a power of two number of pages and at least 16KB, but never more than the
+ * default. Entry functions not seen yet get the default size. Enabling it
+ * also enables profiling (see uthread_set_stack_profiling()), so the profile
+ * keeps up if a function's stack use grows.
+ * 
+ * @param enable Whether to size stacks of threads created from now on
+ * 
+ * @warning A thread that goes deeper than twice the deepest use seen so far
+ *          overflows its stack and is terminated with SIGSEGV. Only suited
+ *          to entry functions whose stack depth does not depend much on
+ *          their input.
+ */
+void uthread_set_adaptive_stacks(bool enable);
+
+/**
+ * @brief Returns how much of a thread's stack has been used.
+ * 
+ * @param[in] utid ID of the thread, which may be the calling thread
+ * @param[out] used Deepest use of the stack so far in bytes, including the
+ *                  thread's control block
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: used is set
+ * @retval -1 Error occurred:
+ *            - Invalid thread ID or thread has been released
+ *            - Thread was created while profiling was disabled
+ *            - used is NULL
+ */
+int uthread_stack_usage(uthread utid, size_t *used);
+
+/**
+ * @brief Returns the deepest stack use recorded for an entry function.
+ * 
+ * @param[in] func Entry function passed when creating threads
+ * 
+ * @return Deepest stack use in bytes of a released, profiled thread that ran
+ *         func, or 0 if there was none
+ */
+size_t uthread_stack_max(void* (*func)(void*));
+
+/**
+ * @brief Enables or disables preemptive time slicing.
+ * 
+ * Each worker arms a timer on its OS thread's CPU time that sends SIGALRM to
+ * it. A thread that runs for a full quantum without giving up the CPU is moved
+ * to the back of the runqueue as if it had called uthread_yield().
+ * 
+ * Threads are only preempted while executing code of the main program. Ticks
+ * that arrive while a thread is inside the uthread library, libc or any other
+ * shared library are ignored and preemption is retried on the next tick, so
+ * locks held internally by those libraries are never held across a switch.
+ * 
+ * @param quantum_ns Maximum time slice in nanoseconds. A thread is preempted
+ *                   after running for between half and one quantum. 0
+ *                   disables preemption.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: preemption enabled or disabled
+ * @retval -1 Error occurred:
+ *            - quantum_ns is shorter than 2 microseconds
+ *            - The signal handler or a timer could not be set up
+ * 
+ * @note The library installs its own handler for SIGALRM, so the application
+ *       must not use that signal. Blocking system calls interrupted by it are
+ *       restarted.
+ * 
+ * @warning Code that is linked statically into the program is preemptible,
+ *          including a statically linked libc. Such code, and any critical
+ *          section that relies on not being interrupted, must be wrapped in
+ *          uthread_preempt_disable() and uthread_preempt_enable().
+ * @warning With more than one worker, a preempted thread is requeued like a
+ *          yielding one and may resume on a different worker OS thread in the
+ *          middle of preemptible code. Addresses of thread-local variables
+ *          computed before that point, which the compiler may keep in
+ *          registers, then refer to the old worker's copies. This includes
+ *          errno, whose address is cached across calls. Code that uses
+ *          thread-local storage must not be preempted between computing such
+ *          an address and its last use, e.g. by wrapping it in
+ *          uthread_preempt_disable() and uthread_preempt_enable().
+ */
+int uthread_set_preemption(uint64_t quantum_ns);
+
+/**
+ * @brief Prevents the calling thread from being preempted.
+ * 
+ * Calls nest: the thread becomes preemptible again once
+ * uthread_preempt_enable() has been called as many times. The thread can still
+ * give up the CPU voluntarily in between.
+ */
+void uthread_preempt_disable();
+
+/**
+ * @brief Undoes one call to uthread_preempt_disable().
+ * 
+ * If the thread would have been preempted while it was not preemptible, it
+ * yields as soon as preemption is enabled again.
+ */
+void uthread_preempt_enable();
+
+/**
+ * @brief Takes a snapshot of the scheduler's counters.
+ * 
+ * Statistics are only kept if the library is built with UTHREAD_STATS
+ * defined (make STATS=1); otherwise they cost nothing and this function fails.
+ * 
+ * @param[out] stats Where to store the counters. Cannot be NULL.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: counters stored
+ * @retval -1 Error occurred:
+ *            - Library built without UTHREAD_STATS
+ *            - Library not initialized
+ *            - stats is NULL
+ * 
+ * @note Counters of other workers are read while they keep running, so they
+ *       may be slightly out of date.
+ */
+int uthread_stats(struct uthread_stats *stats);
+
+/**
+ * @brief Takes a snapshot of a thread's counters.
+ * 
+ * Run and wait times are measured with the TSC at every context switch. The
+ * run time of a running thread includes its current time slice.
+ * Terminated threads can be queried until they are joined.
+ * 
+ * @param[in] utid ID of the thread
+ * @param[out] stats Where to store the counters. Cannot be NULL.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: counters stored
+ * @retval -1 Error occurred:
+ *            - Library built without UTHREAD_STATS
+ *            - Invalid thread ID
+ *            - Thread does not exist or has already been released
+ *            - stats is NULL
+ */
+int uthread_thread_stats(uthread utid, struct uthread_thread_stats *stats);
+
+#endif
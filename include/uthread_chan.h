@@ -0,0 +1,112 @@
+/**
+ * @file uthread_chan.h
+ * @brief Bounded channels for passing messages between uthreads
+ * 
+ * A channel carries fixed-size elements from senders to receivers. A buffered
+ * channel holds up to its capacity of elements; an unbuffered channel
+ * (capacity 0) makes each send wait until a receiver takes the element.
+ * 
+ * When a receiver is already waiting, a sender copies the element straight
+ * into the receiver's destination and switches to it directly, without a trip
+ * through the runqueue. Under the PS, FAIR and EDF policies this only happens
+ * if the sender would not be scheduled ahead of the receiver (e.g. has a
+ * higher priority under PS); otherwise the receiver is made ready as usual.
+ */
+
+#ifndef UTHREAD_CHAN_H
+#define UTHREAD_CHAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct uthread_chan *uthread_chan;
+
+typedef enum {
+    UTHREAD_CHAN_SEND,
+    UTHREAD_CHAN_RECV
+} uthread_chan_op;
+
+// One operation of a uthread_chan_select() call
+struct uthread_chan_case {
+    uthread_chan chan;
+    uthread_chan_op op;
+    void *elem; // element to send, or destination of the received element
+    bool ok;    // set by select: false if the case completed because the
+                // channel was closed
+};
+
+/**
+ * @brief Creates a channel.
+ * 
+ * @param[in] elem_size Size in bytes of each element. Must not be 0.
+ * @param[in] capacity Number of elements buffered. 0 creates an unbuffered
+ *                     channel.
+ * 
+ * @return The new channel, or NULL on error
+ */
+uthread_chan uthread_chan_create(size_t elem_size, int capacity);
+
+/**
+ * @brief Destroys a channel.
+ * 
+ * @param[in] c Channel to destroy. No thread may be waiting on it.
+ */
+void uthread_chan_destroy(uthread_chan c);
+
+/**
+ * @brief Sends an element, sleeping until there is room for it.
+ * 
+ * On a buffered channel, returns once the element is buffered or taken by a
+ * receiver. On an unbuffered channel, returns once a receiver has taken it.
+ * 
+ * @param[in] c Channel to send on
+ * @param[in] elem Element to send, elem_size bytes are copied from it
+ * 
+ * @return 0 on success, -1 if the channel is (or gets) closed before the
+ *         element could be sent
+ */
+int uthread_chan_send(uthread_chan c, const void *elem);
+
+/**
+ * @brief Receives an element, sleeping until one is available.
+ * 
+ * @param[in] c Channel to receive from
+ * @param[out] elem Destination for the element, elem_size bytes are copied to
+ *                  it
+ * 
+ * @return 0 on success, -1 if the channel is closed and no element is left
+ */
+int uthread_chan_recv(uthread_chan c, void *elem);
+
+/**
+ * @brief Closes a channel.
+ * 
+ * Waiting senders fail and no further elements can be sent. Receivers can
+ * still take buffered elements, after which receiving fails.
+ * 
+ * @param[in] c Channel to close
+ * 
+ * @return 0 on success, -1 if the channel is already closed
+ */
+int uthread_chan_close(uthread_chan c);
+
+/**
+ * @brief Waits until one of several channel operations can proceed and
+ * performs it.
+ * 
+ * If several cases are ready, one of them is chosen at random so that no
+ * channel is starved. Exactly one case is performed.
+ * 
+ * @param[in,out] cases Operations to wait for
+ * @param[in] n Number of cases
+ * @param[in] block Whether to sleep if no case is ready
+ * 
+ * @return Index of the case that was performed, or -1 if no case was ready
+ *         and block is false, or on error
+ * 
+ * @note A case completes with ok set to false if its channel is closed:
+ *       a send fails, and a receive finds the channel empty.
+ */
+int uthread_chan_select(struct uthread_chan_case *cases, int n, bool block);
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file uthread_gen.h
+ * @brief Generators: uthreads that produce a sequence of values on demand
+ *
+ * A generator runs its body on a thread of its own, which only runs while
+ * its consumer asks for the next value. uthread_gen_next() switches straight
+ * to the generator's thread and uthread_gen_yield() straight back, so each
+ * value costs one context switch in each direction and never goes through
+ * the runqueue, whatever the scheduling policy.
+ */
+
+#ifndef UTHREAD_GEN_H
+#define UTHREAD_GEN_H
+
+typedef struct uthread_gen *uthread_gen;
+
+/**
+ * @brief Creates a generator.
+ *
+ * The body does not start until the first uthread_gen_next(). It passes
+ * values to the consumer with uthread_gen_yield() and ends the sequence by
+ * returning.
+ *
+ * @param[in] func Body of the generator
+ * @param[in] args Argument to pass to func. Can be NULL.
+ *
+ * @return The new generator, or NULL on error
+ *
+ * @warning The body must return rather than call uthread_exit(), or its
+ *          consumer sleeps forever.
+ */
+uthread_gen uthread_gen_create(void (*func)(void*), void *args);
+
+/**
+ * @brief Destroys a generator.
+ *
+ * If the body has not returned yet, it is resumed with uthread_gen_yield()
+ * failing until it does.
+ *
+ * @param[in] gen Generator to destroy
+ */
+void uthread_gen_destroy(uthread_gen gen);
+
+/**
+ * @brief Runs a generator until it yields its next value.
+ *
+ * The calling thread sleeps while the body runs. Only one thread at a time
+ * may consume a generator.
+ *
+ * @param[in] gen Generator to resume
+ * @param[out] value Destination for the value. May be NULL.
+ *
+ * @return 0 on success, -1 if the body has returned
+ */
+int uthread_gen_next(uthread_gen gen, void **value);
+
+/**
+ * @brief Passes a value to the consumer of the calling generator.
+ *
+ * Called from the body of a generator, returns once the consumer asks for
+ * the next value.
+ *
+ * @param[in] value Value returned by the consumer's uthread_gen_next()
+ *
+ * @return 0 on success, -1 if not called from a generator's body or the
+ *         generator is being destroyed. The body should return in that case.
+ */
+int uthread_gen_yield(void *value);
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file uthread_io.h
+ * @brief Non-blocking I/O for uthreads
+ * 
+ * A blocking system call stalls every uthread that shares the calling worker
+ * OS thread. The functions below instead attempt the operation without
+ * blocking and, if the file descriptor is not ready, put the calling thread to
+ * sleep until it is, letting other threads run in the meantime.
+ * 
+ * File descriptors used with these functions are switched to non-blocking mode
+ * (O_NONBLOCK). When no thread is ready to run, the scheduler blocks in the
+ * poller until one of the awaited file descriptors becomes ready.
+ */
+
+#ifndef UTHREAD_IO_H
+#define UTHREAD_IO_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Reads from a file descriptor, sleeping the calling thread until data
+ * is available.
+ * 
+ * Same semantics as read(2), except that the calling thread sleeps instead of
+ * blocking the worker while fd has no data.
+ * 
+ * @param[in] fd File descriptor to read from
+ * @param[out] buf Buffer to read into
+ * @param[in] count Maximum number of bytes to read
+ * 
+ * @return Number of bytes read (0 at end of file), or -1 on error with errno
+ *         set as by read(2)
+ */
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+/**
+ * @brief Writes to a file descriptor, sleeping the calling thread until it
+ * can accept data.
+ * 
+ * Same semantics as write(2), except that the calling thread sleeps instead of
+ * blocking the worker while fd is full. Like write(2), fewer than count bytes
+ * may be written.
+ * 
+ * @param[in] fd File descriptor to write to
+ * @param[in] buf Data to write
+ * @param[in] count Number of bytes to write
+ * 
+ * @return Number of bytes written, or -1 on error with errno set as by
+ *         write(2)
+ */
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+/**
+ * @brief Accepts a connection on a socket, sleeping the calling thread until
+ * one is pending.
+ * 
+ * Same semantics as accept(2), except that the calling thread sleeps instead
+ * of blocking the worker. The returned socket is already in non-blocking mode.
+ * 
+ * @param[in] sockfd Listening socket
+ * @param[out] addr Address of the peer. Can be NULL.
+ * @param[in,out] addrlen Size of addr. Can be NULL if addr is NULL.
+ * 
+ * @return File descriptor of the accepted socket, or -1 on error with errno
+ *         set as by accept(2)
+ */
+int uthread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+
+/**
+ * @brief Sleeps the calling thread until a file descriptor is readable.
+ * 
+ * @param[in] fd File descriptor to wait for
+ * 
+ * @return 0 once fd is readable (or has an error pending), -1 on error
+ */
+int uthread_wait_readable(int fd);
+
+/**
+ * @brief Sleeps the calling thread until a file descriptor is writable.
+ * 
+ * @param[in] fd File descriptor to wait for
+ * 
+ * @return 0 once fd is writable (or has an error pending), -1 on error
+ */
+int uthread_wait_writable(int fd);
+
+#endif
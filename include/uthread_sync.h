@@ -0,0 +1,166 @@
+/**
+ * @file uthread_sync.h
+ * @brief Blocking synchronization primitives for uthreads
+ * 
+ * Mutexes, condition variables and semaphores that put waiting threads to
+ * sleep instead of spinning, letting other threads run. Ownership is handed
+ * directly to the next waiter on release, so a woken thread never has to
+ * compete for the primitive again.
+ * 
+ * Waiters are woken in order of priority under priority scheduling (PS), and
+ * in arrival order otherwise.
+ * 
+ * @note Primitives should be created after uthread_init(), since waiter
+ *       ordering follows the scheduling policy at creation time.
+ */
+
+#ifndef UTHREAD_SYNC_H
+#define UTHREAD_SYNC_H
+
+typedef struct uthread_mutex *uthread_mutex;
+typedef struct uthread_cond *uthread_cond;
+typedef struct uthread_sem *uthread_sem;
+
+/**
+ * @brief Creates a mutex.
+ * 
+ * @return The new unlocked mutex, or NULL if memory allocation failed
+ */
+uthread_mutex uthread_mutex_create();
+
+/**
+ * @brief Destroys a mutex.
+ * 
+ * @param[in] m Mutex to destroy. Must be unlocked and have no waiters.
+ */
+void uthread_mutex_destroy(uthread_mutex m);
+
+/**
+ * @brief Locks a mutex, sleeping until it is available.
+ * 
+ * @param[in] m Mutex to lock
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: the calling thread owns the mutex
+ * @retval -1 Error occurred:
+ *            - The calling thread already owns the mutex
+ */
+int uthread_mutex_lock(uthread_mutex m);
+
+/**
+ * @brief Locks a mutex if it is available, without sleeping.
+ * 
+ * @param[in] m Mutex to lock
+ * 
+ * @return 0 if the mutex was locked, -1 if it is owned by a thread
+ */
+int uthread_mutex_trylock(uthread_mutex m);
+
+/**
+ * @brief Unlocks a mutex.
+ * 
+ * If threads are waiting for the mutex, ownership passes directly to the
+ * first of them, which is made ready.
+ * 
+ * @param[in] m Mutex to unlock
+ * 
+ * @return 0 on success, -1 if the calling thread does not own the mutex
+ */
+int uthread_mutex_unlock(uthread_mutex m);
+
+/**
+ * @brief Creates a condition variable.
+ * 
+ * @return The new condition variable, or NULL if memory allocation failed
+ */
+uthread_cond uthread_cond_create();
+
+/**
+ * @brief Destroys a condition variable.
+ * 
+ * @param[in] c Condition variable to destroy. Must have no waiters.
+ */
+void uthread_cond_destroy(uthread_cond c);
+
+/**
+ * @brief Atomically unlocks a mutex and sleeps until the condition variable
+ * is signaled.
+ * 
+ * The mutex is owned by the calling thread again when this function returns.
+ * A signaled waiter is moved to the mutex's waiters rather than woken, so it
+ * does not wake up only to find the mutex still locked.
+ * 
+ * @param[in] c Condition variable to wait on
+ * @param[in] m Mutex owned by the calling thread. All threads waiting on c at
+ *              the same time must use the same mutex.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: the condition variable was signaled
+ * @retval -1 Error occurred:
+ *            - The calling thread does not own the mutex
+ *            - Other threads are waiting on c with a different mutex
+ */
+int uthread_cond_wait(uthread_cond c, uthread_mutex m);
+
+/**
+ * @brief Wakes one thread waiting on a condition variable.
+ * 
+ * @param[in] c Condition variable to signal. Nothing happens if no thread is
+ *              waiting.
+ */
+void uthread_cond_signal(uthread_cond c);
+
+/**
+ * @brief Wakes all threads waiting on a condition variable.
+ * 
+ * @param[in] c Condition variable to broadcast
+ */
+void uthread_cond_broadcast(uthread_cond c);
+
+/**
+ * @brief Creates a counting semaphore.
+ * 
+ * @param[in] value Initial value. Must not be negative.
+ * 
+ * @return The new semaphore, or NULL on error
+ */
+uthread_sem uthread_sem_create(int value);
+
+/**
+ * @brief Destroys a semaphore.
+ * 
+ * @param[in] s Semaphore to destroy. Must have no waiters.
+ */
+void uthread_sem_destroy(uthread_sem s);
+
+/**
+ * @brief Decrements a semaphore, sleeping while its value is 0.
+ * 
+ * @param[in] s Semaphore to decrement
+ * 
+ * @return 0 once the semaphore has been decremented
+ */
+int uthread_sem_wait(uthread_sem s);
+
+/**
+ * @brief Decrements a semaphore if its value is positive, without sleeping.
+ * 
+ * @param[in] s Semaphore to decrement
+ * 
+ * @return 0 if the semaphore was decremented, -1 if its value is 0
+ */
+int uthread_sem_trywait(uthread_sem s);
+
+/**
+ * @brief Increments a semaphore.
+ * 
+ * If threads are waiting, the first of them is woken and consumes the
+ * increment directly.
+ * 
+ * @param[in] s Semaphore to increment
+ */
+void uthread_sem_post(uthread_sem s);
+
+#endif
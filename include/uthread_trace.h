@@ -0,0 +1,67 @@
+/**
+ * @file uthread_trace.h
+ * @brief Scheduler event tracing for uthreads
+ * 
+ * Records thread creation, context switches, wakeups, exits and the release of
+ * terminated threads into a fixed-size in-memory ring per worker, timestamped
+ * with the TSC. The trace can be written out in the Chrome trace event format
+ * and opened in chrome://tracing or Perfetto, where each worker is a track
+ * showing which thread ran when.
+ * 
+ * Tracing is only available if the library is built with UTHREAD_TRACE
+ * defined (make TRACE=1). Otherwise recording compiles to nothing and these
+ * functions fail.
+ */
+
+#ifndef UTHREAD_TRACE_H
+#define UTHREAD_TRACE_H
+
+#include <stddef.h>
+
+/**
+ * @brief Starts recording scheduler events.
+ * 
+ * Discards any previous trace. Each worker keeps its most recent events; once
+ * its ring is full, the oldest ones are overwritten.
+ * 
+ * @param[in] events Number of events each worker keeps. Rounded up to a power
+ *                   of two.
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: tracing started
+ * @retval -1 Error occurred:
+ *            - Library built without UTHREAD_TRACE
+ *            - events is 0
+ *            - Memory allocation failed, in which case a running or
+ *              previous trace is left as it was
+ * 
+ * @note If the library is not initialized, it is initialized with defaults.
+ */
+int uthread_trace_start(size_t events);
+
+/**
+ * @brief Stops recording scheduler events. The trace is kept for
+ * uthread_trace_dump().
+ */
+void uthread_trace_stop();
+
+/**
+ * @brief Writes the recorded trace to a file as Chrome trace event JSON.
+ * 
+ * @param[in] path File to write
+ * 
+ * @return 0 on success, -1 on error
+ * 
+ * @retval 0 Success: trace written
+ * @retval -1 Error occurred:
+ *            - Library built without UTHREAD_TRACE
+ *            - Tracing was never started
+ *            - The file could not be written
+ * 
+ * @warning With multiple workers, call uthread_trace_stop() first. Events
+ *          recorded while the trace is being written may appear garbled.
+ */
+int uthread_trace_dump(const char *path);
+
+#endif
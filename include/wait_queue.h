@@ -0,0 +1,24 @@
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include "thread.h"
+#include "thread_queue.h"
+
+// Wait Queue
+//
+// Queue of sleeping threads that follows the scheduling policy: under PS the
+// highest-priority waiter is woken first, otherwise waiters are woken in
+// arrival order. With multiple workers, callers must hold sched_lock.
+
+struct wait_queue {
+    thread_queue fifo;
+    thread_pqueue ps;
+};
+
+int wait_queue_init(struct wait_queue *wq);
+void wait_queue_destroy(struct wait_queue *wq);
+void wait_queue_enqueue(struct wait_queue *wq, struct thread *thread);
+struct thread* wait_queue_dequeue(struct wait_queue *wq);
+int wait_queue_size(struct wait_queue *wq);
+
+#endif
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include "poller.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// Maximum number of epoll events handled per poll
+#define POLL_BATCH 64
+
+// Thread waiting for a file descriptor, lives on the waiting thread's stack
+struct io_waiter {
+    struct thread *thread;
+    uint32_t events;
+    struct io_waiter *next;
+};
+
+// Waiters of one file descriptor, indexed by fd
+struct io_fd {
+    struct io_waiter *waiters;
+    bool registered; // fd has been added to the epoll instance
+};
+
+struct poller {
+    int epoll_fd;
+    int notify_fd;       // eventfd that stays registered, see poller_notify()
+    struct io_fd *fds;   // protected by sched_lock like waiter_count
+    int fd_capacity;
+    int waiter_count;
+    spinlock poll_lock;  // held by the worker blocked in epoll_wait()
+};
+
+poller poller_create() {
+    poller p = malloc(sizeof(struct poller));
+    if (p == NULL)
+        return NULL;
+
+    p->fds = NULL;
+    p->fd_capacity = 0;
+    p->waiter_count = 0;
+    p->poll_lock = (spinlock) SPINLOCK_INIT;
+    p->notify_fd = -1;
+    p->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (p->epoll_fd >= 0)
+        p->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // level-triggered, it stays ready until a poll reads it
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = p->notify_fd };
+    if (p->notify_fd < 0 || epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, p->notify_fd, &ev)) {
+        if (p->notify_fd >= 0)
+            close(p->notify_fd);
+        if (p->epoll_fd >= 0)
+            close(p->epoll_fd);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void poller_destroy(poller p) {
+    if (p == NULL)
+        return;
+
+    close(p->notify_fd);
+    close(p->epoll_fd);
+    free(p->fds);
+    free(p);
+}
+
+void poller_notify(poller p) {
+    uint64_t one = 1;
+    if (write(p->notify_fd, &one, sizeof(one)) < 0) {
+        // the counter can only be full if the poller has plenty of wakeups
+        // pending already
+    }
+}
+
+static struct io_fd *io_fd_get(poller p, int fd) {
+    if (fd >= p->fd_capacity) {
+        int capacity = p->fd_capacity ? p->fd_capacity : 64;
+        while (capacity <= fd)
+            capacity *= 2;
+
+        struct io_fd *fds = realloc(p->fds, capacity * sizeof(struct io_fd));
+        if (fds == NULL)
+            return NULL;
+        for (int i = p->fd_capacity; i < capacity; i++) {
+            fds[i].waiters = NULL;
+            fds[i].registered = false;
+        }
+        p->fds = fds;
+        p->fd_capacity = capacity;
+    }
+    return &p->fds[fd];
+}
+
+// Arms fd for one notification covering the events of all its waiters
+static int io_fd_arm(poller p, int fd, struct io_fd *f) {
+    struct epoll_event ev = { .events = EPOLLONESHOT, .data.fd = fd };
+    for (struct io_waiter *w = f->waiters; w != NULL; w = w->next)
+        ev.events |= w->events;
+
+    if (f->registered && !epoll_ctl(p->epoll_fd, EPOLL_CTL_MOD, fd, &ev))
+        return 0;
+    if (f->registered && errno != ENOENT)
+        return -1;
+
+    // first use of fd, or it was closed and the number reused since
+    f->registered = !epoll_ctl(p->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    return f->registered ? 0 : -1;
+}
+
+int poller_wait(poller p, int fd, uint32_t events) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    sched_lock_acquire();
+
+    struct io_fd *f = io_fd_get(p, fd);
+    if (f == NULL) {
+        sched_lock_release();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct io_waiter waiter = { thread_current(), events, f->waiters };
+    f->waiters = &waiter;
+    if (io_fd_arm(p, fd, f)) {
+        f->waiters = waiter.next;
+        sched_lock_release();
+        return -1;
+    }
+
+    __atomic_add_fetch(&p->waiter_count, 1, __ATOMIC_RELAXED);
+    thread_switch(SLP); // releases sched_lock
+
+    return 0;
+}
+
+int poller_poll(poller p, int64_t timeout_ns) {
+    if (!spinlock_trylock(&p->poll_lock))
+        return -1;
+
+    struct epoll_event events[POLL_BATCH];
+    struct timespec timeout = { timeout_ns / 1000000000, timeout_ns % 1000000000 };
+    int n = epoll_pwait2(p->epoll_fd, events, POLL_BATCH, timeout_ns < 0 ? NULL : &timeout, NULL);
+    if (n < 0 && errno == ENOSYS) {
+        // kernel older than 5.11, round up to whole milliseconds
+        int timeout_ms = timeout_ns < 0 ? -1 : (timeout_ns + 999999) / 1000000;
+        n = epoll_wait(p->epoll_fd, events, POLL_BATCH, timeout_ms);
+    }
+
+    int woken = 0;
+    sched_lock_acquire();
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == p->notify_fd) {
+            uint64_t count;
+            if (read(p->notify_fd, &count, sizeof(count)) < 0) {
+                // already reset by another poll
+            }
+            continue;
+        }
+
+        struct io_fd *f = &p->fds[fd];
+        uint32_t ready = events[i].events;
+        if (ready & (EPOLLERR | EPOLLHUP))
+            ready = ~0u; // let every waiter find out about the error
+
+        struct io_waiter **link = &f->waiters;
+        while (*link != NULL) {
+            struct io_waiter *w = *link;
+            if (w->events & ready) {
+                *link = w->next;
+                thread_wake(w->thread);
+                woken++;
+            } else {
+                link = &w->next;
+            }
+        }
+
+        if (f->waiters != NULL && io_fd_arm(p, fd, f)) {
+            // cannot rearm, wake the rest so they retry and see the error
+            for (struct io_waiter *w = f->waiters; w != NULL; w = w->next) {
+                thread_wake(w->thread);
+                woken++;
+            }
+            f->waiters = NULL;
+        }
+    }
+    __atomic_sub_fetch(&p->waiter_count, woken, __ATOMIC_RELAXED);
+    sched_lock_release();
+
+    spinlock_unlock(&p->poll_lock);
+    return woken;
+}
+
+bool poller_waiting(poller p) {
+    return __atomic_load_n(&p->waiter_count, __ATOMIC_RELAXED) > 0;
+}
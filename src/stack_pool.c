@@ -0,0 +1,174 @@
+#include "stack_pool.h"
+#include "spinlock.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Lightweight guard regions (Linux 6.13). Unlike a PROT_NONE mapping they do
+// not split the stack's VMA, so the number of stacks is not capped by
+// vm.max_map_count.
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+// Stack Pool Implementation
+
+// Cached stacks are linked through their topmost bytes, which are the most
+// likely to still be resident
+struct free_stack {
+    struct free_stack *next;
+};
+
+struct stack_pool {
+    size_t stack_size; // usable bytes per stack, multiple of the page size
+    size_t page_size;
+    struct free_stack *free_list;
+    int cached;
+    int max_cached;
+    bool guard_markers; // MADV_GUARD_INSTALL is supported
+    spinlock lock;
+};
+
+stack_pool stack_pool_create(size_t stack_size, int max_cached) {
+    if (stack_size == 0 || max_cached < 0)
+        return NULL;
+
+    stack_pool pool = malloc(sizeof(struct stack_pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->page_size = sysconf(_SC_PAGESIZE);
+    pool->stack_size = (stack_size + pool->page_size - 1) & ~(pool->page_size - 1);
+    pool->free_list = NULL;
+    pool->cached = 0;
+    pool->max_cached = max_cached;
+    pool->guard_markers = true;
+    pool->lock = (spinlock) SPINLOCK_INIT;
+    return pool;
+}
+
+static inline struct free_stack *free_stack_node(stack_pool pool, void *stack) {
+    return (struct free_stack*) ((uintptr_t) stack + pool->stack_size) - 1;
+}
+
+static inline void *free_stack_base(stack_pool pool, struct free_stack *s) {
+    return (void*) ((uintptr_t) (s + 1) - pool->stack_size);
+}
+
+static void stack_unmap(stack_pool pool, void *stack) {
+    munmap((void*) ((uintptr_t) stack - pool->page_size), pool->stack_size + pool->page_size);
+}
+
+void stack_pool_destroy(stack_pool pool) {
+    if (pool == NULL)
+        return;
+
+    while (pool->free_list != NULL) {
+        struct free_stack *s = pool->free_list;
+        pool->free_list = s->next;
+        stack_unmap(pool, free_stack_base(pool, s));
+    }
+    free(pool);
+}
+
+// Makes the first page of a newly mapped stack region its guard page
+static int stack_guard(stack_pool pool, void *base) {
+    bool guarded = false;
+    if (__atomic_load_n(&pool->guard_markers, __ATOMIC_RELAXED)) {
+        guarded = !madvise(base, pool->page_size, MADV_GUARD_INSTALL);
+        if (!guarded)
+            __atomic_store_n(&pool->guard_markers, false, __ATOMIC_RELAXED); // older kernel
+    }
+    if (!guarded && mprotect(base, pool->page_size, PROT_NONE))
+        return -1;
+    return 0;
+}
+
+void* stack_pool_alloc(stack_pool pool) {
+    spinlock_lock(&pool->lock);
+    struct free_stack *s = pool->free_list;
+    if (s != NULL) {
+        pool->free_list = s->next;
+        pool->cached--;
+    }
+    spinlock_unlock(&pool->lock);
+
+    if (s != NULL)
+        return free_stack_base(pool, s); // reuse a cached stack
+
+    // reserve guard page and stack together, then make the guard inaccessible
+    size_t len = pool->stack_size + pool->page_size;
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    if (stack_guard(pool, base)) {
+        munmap(base, len);
+        return NULL;
+    }
+
+    return (void*) ((uintptr_t) base + pool->page_size);
+}
+
+int stack_pool_alloc_batch(stack_pool pool, void **stacks, int n) {
+    int got = 0;
+
+    spinlock_lock(&pool->lock);
+    while (got < n && pool->free_list != NULL) {
+        struct free_stack *s = pool->free_list;
+        pool->free_list = s->next;
+        pool->cached--;
+        stacks[got++] = free_stack_base(pool, s);
+    }
+    spinlock_unlock(&pool->lock);
+
+    if (got == n)
+        return 0;
+
+    // map all remaining stacks with their guard pages as one region, which
+    // stays a single VMA if guard markers are supported
+    size_t len = pool->stack_size + pool->page_size;
+    int rest = n - got;
+    char *base = mmap(NULL, rest * len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED)
+        goto fail;
+
+    for (int i = 0; i < rest; i++) {
+        if (stack_guard(pool, base + i * len)) {
+            munmap(base + i * len, (rest - i) * len);
+            goto fail;
+        }
+        stacks[got++] = base + i * len + pool->page_size;
+    }
+    return 0;
+
+fail:
+    for (int i = 0; i < got; i++)
+        stack_pool_free(pool, stacks[i]);
+    return -1;
+}
+
+void stack_pool_free(stack_pool pool, void *stack) {
+    if (stack == NULL)
+        return;
+
+    spinlock_lock(&pool->lock);
+    if (pool->cached < pool->max_cached) {
+        struct free_stack *s = free_stack_node(pool, stack);
+        s->next = pool->free_list;
+        pool->free_list = s;
+        pool->cached++;
+        stack = NULL;
+    }
+    spinlock_unlock(&pool->lock);
+
+    if (stack != NULL)
+        stack_unmap(pool, stack); // cache is full
+}
+
+size_t stack_pool_stack_size(stack_pool pool) {
+    return pool->stack_size;
+}
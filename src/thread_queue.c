@@ -1,202 +1,293 @@
 #include "thread_queue.h"
+#include "uthread.h"
+#include <assert.h>
 #include <stdlib.h>
 
 // Thread Queue Implementation
 
 struct thread_queue {
-    struct thread **arr;
-    int capacity;
-    int head;
-    int tail;
+    struct thread *head;
+    struct thread *tail;
+    int size;
 };
 
-thread_queue thread_queue_create(int capacity) {
-    if (capacity < 2)
-        return NULL;
-
-    thread_queue q = malloc(sizeof(thread_queue));
-    if (q == NULL)
-        return NULL;
-    
-    q->arr = (struct thread**) malloc(capacity * sizeof(struct thread*));
-    if (q->arr == NULL) {
-        free(q);
-        return NULL;
-    }
-
-    q->capacity = capacity;
-    q->head = -1;
-    q->tail = 0;
-    return q;
+thread_queue thread_queue_create() {
+    return calloc(1, sizeof(struct thread_queue));
 }
 
 void thread_queue_destroy(thread_queue q) {
-    if (q == NULL)
-        return;
-    
-    free(q->arr);
     free(q);
 }
 
-int thread_queue_enqueue(thread_queue q, struct thread *thread) {
-    if (thread_queue_size(q) == q->capacity)
-        return -1; // queue is full
-    
-    if (thread_queue_size(q) == 0) {
-        q->head = 0;
-        q->tail = 0;
-    } else {
-        q->tail = (q->tail+ 1) % q->capacity;
-    }
-    
-    q->arr[q->tail] = thread;
-    return 0;
+void thread_queue_enqueue(thread_queue q, struct thread *thread) {
+    assert(thread->queue == NULL);
+
+    thread->queue = q;
+    thread->queue_next = NULL;
+    thread->queue_prev = q->tail;
+    if (q->tail != NULL)
+        q->tail->queue_next = thread;
+    else
+        q->head = thread;
+    q->tail = thread;
+    q->size++;
 }
 
-struct thread* thread_queue_dequeue(thread_queue q) {
-    if (thread_queue_size(q) == 0)
-        return NULL; // queue is empty
-
-    struct thread *next = q->arr[q->head];
-
-    if (thread_queue_size(q) == 1) {
-        q->head = -1;
-        q->tail = 0;
-    } else {
-        q->head = (q->head + 1) % q->capacity;
-    }
+// Unlinks a thread that is on q
+static void thread_queue_unlink(thread_queue q, struct thread *thread) {
+    if (thread->queue_prev != NULL)
+        thread->queue_prev->queue_next = thread->queue_next;
+    else
+        q->head = thread->queue_next;
+    if (thread->queue_next != NULL)
+        thread->queue_next->queue_prev = thread->queue_prev;
+    else
+        q->tail = thread->queue_prev;
+
+    thread->queue = NULL;
+    q->size--;
+}
 
+struct thread* thread_queue_dequeue(thread_queue q) {
+    struct thread *next = q->head;
+    if (next != NULL)
+        thread_queue_unlink(q, next);
     return next;
 }
 
 struct thread* thread_queue_peek(thread_queue q) {
-    if (thread_queue_size(q) == 0)
-        return NULL; // queue is empty
-    
-    return q->arr[q->head];
+    return q->head;
+}
+
+int thread_queue_remove(thread_queue q, struct thread *thread) {
+    if (thread->queue != q)
+        return -1; // thread is not queued here
+
+    thread_queue_unlink(q, thread);
+    return 0;
 }
 
 int thread_queue_size(thread_queue q) {
-    if (q->head == -1) 
-        return 0;
-    return (q->tail - q->head + q->capacity) % q->capacity + 1;
+    return q->size;
 }
 
 // Thread Priority Queue Implementation
+//
+// One FIFO queue per priority level, plus a bitmap of the non-empty levels.
+// Bit 0 stands for MAX_PRIORITY, so the highest non-empty level is the lowest
+// set bit.
+
+#define PRIORITY_LEVELS (MAX_PRIORITY - MIN_PRIORITY + 1)
+#define PRIORITY_LEVEL(priority) (MAX_PRIORITY - (priority))
+
+_Static_assert(PRIORITY_LEVELS <= 64, "priority levels must fit in the bitmap");
 
 struct thread_pqueue {
+    uint64_t bitmap;
+    int size;
+    struct thread_queue levels[PRIORITY_LEVELS];
+};
+
+thread_pqueue thread_pqueue_create() {
+    return calloc(1, sizeof(struct thread_pqueue));
+}
+
+void thread_pqueue_destroy(thread_pqueue pq) {
+    free(pq);
+}
+
+void thread_pqueue_enqueue(thread_pqueue pq, struct thread *thread) {
+    int level = PRIORITY_LEVEL(thread->priority);
+
+    thread_queue_enqueue(&pq->levels[level], thread);
+    pq->bitmap |= 1ULL << level;
+    pq->size++;
+}
+
+struct thread* thread_pqueue_dequeue(thread_pqueue pq) {
+    if (pq->size == 0)
+        return NULL; // queue is empty
+
+    int level = __builtin_ctzll(pq->bitmap);
+    struct thread *next = thread_queue_dequeue(&pq->levels[level]);
+    if (pq->levels[level].size == 0)
+        pq->bitmap &= ~(1ULL << level);
+    pq->size--;
+
+    return next;
+}
+
+struct thread* thread_pqueue_peek(thread_pqueue pq) {
+    if (pq->size == 0)
+        return NULL; // queue is empty
+
+    return pq->levels[__builtin_ctzll(pq->bitmap)].head;
+}
+
+int thread_pqueue_remove(thread_pqueue pq, struct thread *thread) {
+    int level = PRIORITY_LEVEL(thread->priority);
+    if (thread_queue_remove(&pq->levels[level], thread))
+        return -1; // thread is not queued
+
+    if (pq->levels[level].size == 0)
+        pq->bitmap &= ~(1ULL << level);
+    pq->size--;
+    return 0;
+}
+
+int thread_pqueue_size(thread_pqueue pq) {
+    return pq->size;
+}
+
+// Thread Heap Implementation
+
+struct thread_heap {
     struct thread **arr;
     int capacity;
     int size;
+    bool (*before)(struct thread*, struct thread*);
 };
 
-thread_pqueue thread_pqueue_create(int capacity) {
+thread_heap thread_heap_create(int capacity, bool (*before)(struct thread*, struct thread*)) {
     if (capacity < 2)
         return NULL;
 
-    thread_pqueue pq = malloc(sizeof(thread_pqueue));
-    if (pq == NULL)
+    thread_heap h = malloc(sizeof(struct thread_heap));
+    if (h == NULL)
         return NULL;
-    
-    pq->arr = (struct thread**) malloc(capacity * sizeof(struct thread*));
-    if (pq->arr == NULL) {
-        free(pq);
+
+    h->arr = malloc(capacity * sizeof(struct thread*));
+    if (h->arr == NULL) {
+        free(h);
         return NULL;
     }
 
-    pq->capacity = capacity;
-    pq->size = 0;
-    return pq;
+    h->capacity = capacity;
+    h->size = 0;
+    h->before = before;
+    return h;
 }
 
-void thread_pqueue_destroy(thread_pqueue pq) {
-    if (pq == NULL)
+void thread_heap_destroy(thread_heap h) {
+    if (h == NULL)
         return;
-    
-    free(pq->arr);
-    free(pq);
-}
-
-static inline int left_child(int idx) {
-    return 2 * idx + 1;
-}
-
-static inline int right_child(int idx) {
-    return 2 * idx + 2;
-}
 
-static inline int parent(int idx) {
-    return (idx - 1) / 2;
+    free(h->arr);
+    free(h);
 }
 
-static inline void swap_indeces(thread_pqueue pq, int idx1, int idx2) {
-    struct thread* temp = pq->arr[idx1];
-    pq->arr[idx1] = pq->arr[idx2];
-    pq->arr[idx2] = temp;
+static inline void heap_place(thread_heap h, int idx, struct thread *thread) {
+    h->arr[idx] = thread;
+    thread->heap_index = idx;
 }
 
-static void heapify_up(thread_pqueue pq) {
-    int idx = pq->size - 1;
+// Moves parents down until the slot for thread is found, starting from idx
+static void heap_sift_up(thread_heap h, int idx, struct thread *thread) {
     while (idx > 0) {
-        int parent_idx = parent(idx);
-        if (pq->arr[parent_idx]->priority >= pq->arr[idx]->priority)
+        int parent = (idx - 1) / 2;
+        if (!h->before(thread, h->arr[parent]))
             break;
-
-        swap_indeces(pq, idx, parent_idx);
-        idx = parent_idx;
+        heap_place(h, idx, h->arr[parent]);
+        idx = parent;
     }
+    heap_place(h, idx, thread);
 }
 
-static void heapify_down(thread_pqueue pq, int idx) {
-    int largest = idx;
-    int l = left_child(idx);
-    int r = right_child(idx);
-    
-    if (l < pq->size && pq->arr[l]->priority > pq->arr[largest]->priority) {
-        largest = l;
-    }
-    
-    if (r < pq->size && pq->arr[r]->priority > pq->arr[largest]->priority) {
-        largest = r;
+// Moves children up until the slot for thread is found, starting from idx
+static void heap_sift_down(thread_heap h, int idx, struct thread *thread) {
+    for (;;) {
+        int child = 2 * idx + 1;
+        if (child >= h->size)
+            break;
+        if (child + 1 < h->size && h->before(h->arr[child + 1], h->arr[child]))
+            child++;
+        if (!h->before(h->arr[child], thread))
+            break;
+        heap_place(h, idx, h->arr[child]);
+        idx = child;
     }
-    
-    if (largest != idx) {
-        swap_indeces(pq, idx, largest);
-        heapify_down(pq, largest);
+    heap_place(h, idx, thread);
+}
+
+int thread_heap_insert(thread_heap h, struct thread *thread) {
+    if (h->size == h->capacity) {
+        struct thread **arr = realloc(h->arr, 2 * h->capacity * sizeof(struct thread*));
+        if (arr == NULL)
+            return -1; // heap is full and cannot grow
+        h->arr = arr;
+        h->capacity *= 2;
     }
+
+    heap_sift_up(h, h->size++, thread);
+    return 0;
 }
 
-int thread_pqueue_enqueue(thread_pqueue pq, struct thread *thread) {
-    if (pq->size == pq->capacity)
-        return -1; // queue is full
-    
-    pq->arr[pq->size] = thread;
-    pq->size++;
+int thread_heap_insert_batch(thread_heap h, struct thread **threads, int n) {
+    if (h->size + n > h->capacity) {
+        int capacity = h->capacity;
+        while (capacity < h->size + n)
+            capacity *= 2;
+        struct thread **arr = realloc(h->arr, capacity * sizeof(struct thread*));
+        if (arr == NULL)
+            return -1; // heap cannot grow
+        h->arr = arr;
+        h->capacity = capacity;
+    }
 
-    heapify_up(pq);
+    if (n < h->size) {
+        // few new threads, sift each of them up
+        for (int i = 0; i < n; i++)
+            heap_sift_up(h, h->size++, threads[i]);
+        return 0;
+    }
 
+    // rebuild the whole heap bottom-up, which takes linear time
+    for (int i = 0; i < n; i++)
+        h->arr[h->size++] = threads[i];
+    for (int i = h->size / 2 - 1; i >= 0; i--)
+        heap_sift_down(h, i, h->arr[i]);
+    for (int i = h->size / 2; i < h->size; i++)
+        h->arr[i]->heap_index = i; // leaves are not moved by the sift downs
     return 0;
 }
 
-struct thread* thread_pqueue_dequeue(thread_pqueue pq) {
-    if (pq->size == 0)
-        return NULL; // queue is empty
-    
-    struct thread* next = pq->arr[0];
-    pq->arr[0] = pq->arr[--pq->size];
+struct thread* thread_heap_extract(thread_heap h) {
+    if (h->size == 0)
+        return NULL; // heap is empty
 
-    heapify_down(pq, 0);
+    struct thread *first = h->arr[0];
+    struct thread *last = h->arr[--h->size];
+    if (h->size > 0)
+        heap_sift_down(h, 0, last);
 
-    return next;
+    return first;
 }
 
-struct thread* thread_pqueue_peek(thread_pqueue pq) {
-    if (pq->size == 0)
-        return NULL; // queue is empty
-    
-    return pq->arr[0];
+struct thread* thread_heap_peek(thread_heap h) {
+    if (h->size == 0)
+        return NULL; // heap is empty
+
+    return h->arr[0];
 }
 
-int thread_pqueue_size(thread_pqueue pq) {
-    return pq->size;
-}
\ No newline at end of file
+int thread_heap_remove(thread_heap h, struct thread *thread) {
+    int idx = thread->heap_index;
+    if (idx < 0 || idx >= h->size || h->arr[idx] != thread)
+        return -1; // thread is not in this heap
+
+    struct thread *last = h->arr[--h->size];
+    if (idx < h->size) {
+        // the last thread takes the removed one's slot, and may have to move
+        // either way from there
+        if (idx > 0 && h->before(last, h->arr[(idx - 1) / 2]))
+            heap_sift_up(h, idx, last);
+        else
+            heap_sift_down(h, idx, last);
+    }
+
+    return 0;
+}
+
+int thread_heap_size(thread_heap h) {
+    return h->size;
+}
@@ -0,0 +1,146 @@
+#include "timer_wheel.h"
+#include <stdlib.h>
+
+// Timer Wheel Implementation
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+struct timer_wheel {
+    uint64_t now; // all timers expiring at or before now have fired
+    int size;
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+timer_wheel timer_wheel_create(uint64_t now) {
+    timer_wheel tw = calloc(1, sizeof(struct timer_wheel));
+    if (tw == NULL)
+        return NULL;
+
+    tw->now = now;
+    return tw;
+}
+
+void timer_wheel_destroy(timer_wheel tw) {
+    free(tw);
+}
+
+static inline int level_shift(int level) {
+    return level * TIMER_WHEEL_BITS;
+}
+
+// A timer goes to the level of the highest bit in which its expiry differs
+// from the current tick, so it always sits in a slot after the current one
+static void timer_insert(timer_wheel tw, struct timer *t) {
+    uint64_t diff = t->expires ^ tw->now;
+    int level = diff ? (63 - __builtin_clzll(diff)) / TIMER_WHEEL_BITS : 0;
+    int slot = (t->expires >> level_shift(level)) & SLOT_MASK;
+
+    struct timer **head = &tw->slots[level][slot];
+    t->next = *head;
+    t->pprev = head;
+    if (*head != NULL)
+        (*head)->pprev = &t->next;
+    *head = t;
+    tw->occupied[level] |= 1ULL << slot;
+}
+
+void timer_wheel_add(timer_wheel tw, struct timer *t) {
+    if (t->expires <= tw->now)
+        t->expires = tw->now + 1;
+    timer_insert(tw, t);
+    tw->size++;
+}
+
+// Clears the occupancy bit of the slot whose list head is at head
+static void slot_clear(timer_wheel tw, struct timer **head) {
+    struct timer **first = &tw->slots[0][0];
+    int idx = head - first;
+    tw->occupied[idx / TIMER_WHEEL_SLOTS] &= ~(1ULL << (idx % TIMER_WHEEL_SLOTS));
+}
+
+void timer_wheel_remove(timer_wheel tw, struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL)
+        t->next->pprev = t->pprev;
+
+    // a timer whose pprev is a slot head was first in its slot
+    struct timer **first = &tw->slots[0][0];
+    if (t->pprev >= first && t->pprev < first + TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS
+            && *t->pprev == NULL)
+        slot_clear(tw, t->pprev);
+
+    t->next = NULL;
+    t->pprev = NULL;
+    tw->size--;
+}
+
+// First tick of the earliest occupied slot across all levels
+static uint64_t next_event(timer_wheel tw) {
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (tw->occupied[level] == 0)
+            continue;
+
+        int shift = level_shift(level);
+        uint64_t slot = __builtin_ctzll(tw->occupied[level]);
+        uint64_t base = shift + TIMER_WHEEL_BITS >= 64 ? 0 : tw->now >> (shift + TIMER_WHEEL_BITS) << (shift + TIMER_WHEEL_BITS);
+        uint64_t start = base + (slot << shift);
+        if (start < next)
+            next = start;
+    }
+    return next;
+}
+
+struct timer* timer_wheel_advance(timer_wheel tw, uint64_t now) {
+    struct timer *expired = NULL;
+
+    while (tw->size > 0) {
+        uint64_t next = next_event(tw);
+        if (next > now)
+            break;
+        tw->now = next;
+
+        // move timers of slots starting at this tick down, highest level first
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            int shift = level_shift(level);
+            if (tw->now & ((1ULL << shift) - 1))
+                continue;
+
+            int slot = (tw->now >> shift) & SLOT_MASK;
+            struct timer *t = tw->slots[level][slot];
+            tw->slots[level][slot] = NULL;
+            tw->occupied[level] &= ~(1ULL << slot);
+            while (t != NULL) {
+                struct timer *next_timer = t->next;
+                timer_insert(tw, t);
+                t = next_timer;
+            }
+        }
+
+        int slot = tw->now & SLOT_MASK;
+        struct timer *t = tw->slots[0][slot];
+        tw->slots[0][slot] = NULL;
+        tw->occupied[0] &= ~(1ULL << slot);
+        while (t != NULL) {
+            struct timer *next_timer = t->next;
+            t->pprev = NULL;
+            t->next = expired;
+            expired = t;
+            tw->size--;
+            t = next_timer;
+        }
+    }
+
+    if (now > tw->now)
+        tw->now = now;
+    return expired;
+}
+
+uint64_t timer_wheel_next(timer_wheel tw) {
+    return tw->size > 0 ? next_event(tw) : UINT64_MAX;
+}
+
+int timer_wheel_size(timer_wheel tw) {
+    return tw->size;
+}
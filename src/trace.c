@@ -0,0 +1,75 @@
+#include "trace.h"
+#include <stdlib.h>
+
+struct trace_ring *trace_ring_create(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+
+    struct trace_ring *r = malloc(sizeof(struct trace_ring));
+    if (r == NULL)
+        return NULL;
+
+    r->events = malloc(size * sizeof(struct trace_event));
+    if (r->events == NULL) {
+        free(r);
+        return NULL;
+    }
+
+    r->mask = size - 1;
+    r->head = 0;
+    return r;
+}
+
+void trace_ring_destroy(struct trace_ring *r) {
+    if (r == NULL)
+        return;
+
+    free(r->events);
+    free(r);
+}
+
+static double trace_us(struct trace_clock *clock, uint64_t tsc) {
+    return (double) (int64_t) (tsc - clock->start_tsc) * clock->us_per_cycle;
+}
+
+static void trace_separator(FILE *f, bool *first) {
+    fputs(*first ? "\n" : ",\n", f);
+    *first = false;
+}
+
+void trace_ring_write_json(FILE *f, struct trace_ring *r, int worker, struct trace_clock *clock,
+                           bool *first) {
+    static const char *names[] = { "create", "switch", "wake", "exit", "reap" };
+
+    trace_separator(f, first);
+    fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+               "\"args\": {\"name\": \"worker %d\"}}", worker, worker);
+
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = head > r->mask + 1 ? head - (r->mask + 1) : 0;
+
+    struct trace_event *running = NULL; // last switch, until the next one ends it
+    for (uint64_t i = tail; i < head; i++) {
+        struct trace_event *e = &r->events[i & r->mask];
+
+        if (e->type == TRACE_SWITCH) {
+            if (running != NULL && running->thread >= 0) {
+                trace_separator(f, first);
+                fprintf(f, "{\"name\": \"uthread %lld\", \"cat\": \"run\", \"ph\": \"X\", "
+                           "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 0, \"tid\": %d}",
+                        (long long) running->thread, trace_us(clock, running->tsc),
+                        trace_us(clock, e->tsc) - trace_us(clock, running->tsc), worker);
+            }
+            running = e;
+            continue;
+        }
+
+        trace_separator(f, first);
+        fprintf(f, "{\"name\": \"%s\", \"cat\": \"sched\", \"ph\": \"i\", \"s\": \"t\", "
+                   "\"ts\": %.3f, \"pid\": 0, \"tid\": %d, "
+                   "\"args\": {\"thread\": %lld, \"by\": %lld}}",
+                names[e->type], trace_us(clock, e->tsc), worker, (long long) e->thread,
+                (long long) e->arg);
+    }
+}
@@ -1,295 +1,2496 @@
-#include "uthread.h"
-#include "context_switch.h"
-#include "thread_queue.h"
-#include <stdlib.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include <assert.h>
-
-#define UTHREAD_DETACHED -2
-
-bool initialized = false;
-sched_policy scheduling_policy = DEFAULT_SCHEDULING_POLICY;
-size_t stack_size = DEFAULT_STACK_SIZE;
-
-struct thread *threads[MAX_THREADS];
-unsigned last_id = 0;
-unsigned thread_count = 0;
-
-thread_queue fifo_runqueue;
-thread_pqueue ps_runqueue;
-thread_queue zombies;
-
-struct thread *curthread;
-struct thread *reaper_thread;
-
-void thread_execute() {
-    // call func(args)
-    void* retval = curthread->func(curthread->args);
-
-    // thread finished
-    uthread_exit(retval);
-}
-
-static void* thread_setup_stack(void *stack_bottom) {
-    // push context to stack 
-    uint64_t *sp = (uint64_t*) stack_bottom;
-    *(--sp) = (uint64_t) thread_execute; // return address 
-    *(--sp) = 0;  // rbp
-    *(--sp) = 0;  // r15
-    *(--sp) = 0;  // r14
-    *(--sp) = 0;  // r13
-    *(--sp) = 0;  // r12
-    *(--sp) = 0;  // r11
-    *(--sp) = 0;  // r10
-    *(--sp) = 0;  // r9
-    *(--sp) = 0;  // r8
-    *(--sp) = 0;  // rdi
-    *(--sp) = 0;  // rsi
-    *(--sp) = 0;  // rdx
-    *(--sp) = 0;  // rcx
-    *(--sp) = 0;  // rbx
-    *(--sp) = 0;  // rax
-
-    return (void*) sp;
-}
-
-static void thread_switch(thread_state state) {
-    assert(state != RUN);
-    assert(curthread->state == RUN);
-    struct thread *oldthread = curthread;
-    struct thread *newthread = NULL;
-    
-    switch (scheduling_policy) {
-        case FIFO:
-            newthread = thread_queue_dequeue(fifo_runqueue);
-            if (newthread == NULL)
-                return; // runqueue is empty
-            newthread->state = RUN;
-            curthread = newthread;
-
-            if (state == RDY)
-               thread_queue_enqueue(fifo_runqueue, oldthread);
-            oldthread->state = state;
-            break;
-        case PS:
-            newthread = thread_pqueue_dequeue(ps_runqueue);
-            if (newthread == NULL)
-                return; // runqueue is empty
-            newthread->state = RUN;
-            curthread = newthread;
-
-            if (state == RDY)
-               thread_pqueue_enqueue(ps_runqueue, oldthread);
-            oldthread->state = state;
-            break;
-        default:
-            // not yet implemented
-    }
-
-    context_switch(&oldthread->sp, curthread->sp);
-}
-
-static void thread_wake(struct thread* t) {
-    assert(t->state == SLP);
-    t->state = RDY;
-    switch (scheduling_policy) {
-        case FIFO:
-            assert(!thread_queue_enqueue(fifo_runqueue, t));
-            break;
-        case PS:
-            assert(!thread_pqueue_enqueue(ps_runqueue, t));
-            break;
-        default:
-            // not yet implemented
-
-    }
-}
-
-static struct thread *thread_create(uthread id, void* (*func)(void*), void* args, int priority) {
-    struct thread *t = malloc(sizeof(struct thread));
-    if (t == NULL) 
-        return NULL; // out of memory
-
-    // allocate and setup thread struct
-    t->stack_end = malloc(stack_size);
-    if (t->stack_end == NULL) {
-        free(t);
-        return NULL; // out of memory
-    }
-
-    t->id = id;
-    t->func = func;
-    t->args = args;
-    t->retval = NULL;
-    t->state = SLP;
-    t->priority = priority;
-    t->join_id = -1;
-
-    void *stack_bottom = (void*) ((uintptr_t) t->stack_end + stack_size);
-    t->sp = thread_setup_stack(stack_bottom);
-
-    return t;
-}
-
-static void thread_destroy(struct thread *t) {
-    assert(t->id != 0); // should not be destroying main thread
-    assert(t != curthread); // should not be destroying current thread
-    assert(t->state == ZMB);
-
-    threads[t->id] = NULL;
-
-    free(t->stack_end);
-    free(t);
-
-    thread_count--;
-}
-
-void* thread_reaper(void *args) {
-    (void) args;
-    for (;;) {
-        int zombie_count = thread_queue_size(zombies);
-        for (int i = 0; i < zombie_count; i++) {
-            struct thread* t = thread_queue_dequeue(zombies);
-            thread_destroy(t);
-        }
-        thread_switch(SLP);
-    }
-    return NULL;
-}
-
-void uthread_init(sched_policy policy, size_t stack_sz) {
-    if (initialized)
-        return;
-    initialized = true;
-
-    stack_size = stack_sz;
-    scheduling_policy = policy;
-
-    switch(policy) {
-        case FIFO:
-            fifo_runqueue = thread_queue_create(MAX_THREADS);
-            break;
-        case PS:
-            ps_runqueue = thread_pqueue_create(MAX_THREADS);
-            break;
-        default:
-            // not yet implemented
-    }
-
-    zombies = thread_queue_create(MAX_THREADS);
-
-    struct thread *main_thread = malloc(sizeof(struct thread));
-    main_thread->id = 0;
-    main_thread->stack_end = NULL;
-    main_thread->sp = NULL;
-    main_thread->state = RUN;
-    main_thread->join_id = -1;
-
-    curthread = main_thread; // main thread is currently running
-    threads[0] = main_thread;
-    thread_count++;
-
-    reaper_thread = thread_create(MAX_THREADS, thread_reaper, NULL, MAX_PRIORITY);
-}
-
-int uthread_create(uthread *thread, void* (*func)(void*), void *args, int priority) {
-    if (!initialized)
-        uthread_init(FIFO, DEFAULT_STACK_SIZE);
-
-    if (thread == NULL)
-        return -1; // invalid uthread pointer  
-
-    if (thread_count + 1 > MAX_THREADS)
-        return -1; // too many threads
-
-    if (priority > MAX_PRIORITY || priority < MIN_PRIORITY)
-        return -1; // invalid priority
-
-    // add to threads array
-    while (threads[last_id] != NULL) {
-        last_id++;
-        if (last_id == MAX_THREADS)
-            last_id = 1;
-    }
-
-    struct thread *t = thread_create(last_id, func, args, priority);
-    if (t == NULL)
-        return -1; // out of memory
-
-    threads[last_id] = t;
-    thread_count++;
-    *thread = last_id;
-
-    // add thread to runqeue
-    thread_wake(t);
-
-    return 0;
-}
-
-int uthread_join(uthread utid, void **retval) {
-    if (utid < 0 || utid >= MAX_THREADS)
-        return -1; // invalid id
-
-    struct thread *t = threads[utid];
-    if (t == NULL)
-        return -1; // thread does not exist
-
-    if (t->join_id == UTHREAD_DETACHED || t->join_id >= 0)
-        return -1; // thread is detached or already marked to join
-
-    t->join_id = curthread->id; 
-    
-    // block if joining thread has not terminated yet
-    if (t->state != ZMB) {
-        thread_switch(SLP);
-    }
-    assert(t->state == ZMB);
-
-    // give return value of joining thread if not NULL
-    if (retval != NULL)
-        *retval = t->retval;
-
-    // cleanup joining thread
-    thread_destroy(t);
-
-    return 0;
-}
-
-void uthread_exit(void *retval) {
-    if (curthread->id == 0)
-        exit(0); // terminate process if main thread calls uthread_exit
-
-    if (curthread->join_id == UTHREAD_DETACHED) {
-        thread_queue_enqueue(zombies, curthread);
-        if (reaper_thread->state == SLP)
-            thread_wake(reaper_thread); // add reaper to runqueue to clean up zombie
-    } else if (curthread->join_id == -1) {
-        curthread->retval = retval;
-    } else {
-        thread_wake(threads[curthread->join_id]);
-        curthread->retval = retval;
-    }
-    thread_switch(ZMB);
-}
-
-int uthread_detach(uthread utid) {
-    if (utid < 0 || utid >= MAX_THREADS)
-        return -1; // invalid id
-
-    struct thread *t = threads[utid];
-    if (t == NULL)
-        return -1; // thread does not exist
-
-    if (t->join_id != -1)
-        return -1; // thread is already detached or marked to join
-
-    t->join_id = UTHREAD_DETACHED; // mark thread as detached
-
-    return 0;
-}
-
-void uthread_yield() {
-    thread_switch(RDY);
-}
\ No newline at end of file
+#define _GNU_SOURCE
+#include "uthread.h"
+#include "context_switch.h"
+#include "thread_queue.h"
+#include "scheduler.h"
+#include "poller.h"
+#include "timer_wheel.h"
+#include "spinlock.h"
+#include "stack_pool.h"
+#include "trace.h"
+#include "uthread_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <link.h>
+#include <ucontext.h>
+
+#define UTHREAD_DETACHED -2
+
+// Maximum number of released stacks kept for reuse
+#define STACK_CACHE_SIZE 64
+
+// Maximum number of terminated threads kept with their stacks for reuse
+#define THREAD_CACHE_SIZE 64
+
+// Number of stack size classes besides the default size, a power of two
+// number of pages each
+#define STACK_CLASSES 24
+
+// Pattern stacks are filled with while profiling their use
+#define STACK_CANARY 0x5afe5afe5afe5afeULL
+
+// Number of entry functions whose deepest stack use is recorded, a power of two
+#define STACK_PROFILE_SIZE 256
+
+// Smallest stack adaptive sizing picks, leaving room for a signal frame with
+// the full vector register state if the thread is preempted
+#define ADAPTIVE_MIN_STACK 16384
+
+// Initial capacity of the thread table and of every thread queue
+#define INITIAL_THREADS 64
+
+// Maximum number of threads stolen from another worker at once
+#define STEAL_BATCH 32
+
+// Number of yields between non-blocking polls for I/O while threads are ready
+#define POLL_INTERVAL 64
+
+// Upper bound on how long a parked worker sleeps while I/O or timers are
+// pending and another worker is blocked in the poller
+#define PARK_TIMEOUT_NS 10000000
+
+// Resolution of sleep timers
+#define TIMER_TICK_NS 1000
+
+// Number of buckets of the address wait table, a power of two
+#define WAIT_TABLE_SIZE 256
+
+#define THREAD_INDEX(id) ((uint32_t) (id))
+#define THREAD_GENERATION(id) ((uint32_t) ((id) >> 32))
+#define THREAD_ID(index, generation) ((uthread) (generation) << 32 | (index))
+#define NO_SLOT UINT32_MAX
+
+// Floating point control state new threads start with (the power-on defaults:
+// all exceptions masked, round to nearest, extended precision x87)
+#define DEFAULT_MXCSR 0x1f80ULL
+#define DEFAULT_FPU_CW 0x037fULL
+
+// Vruntime credit given to a woken thread under FAIR, in TSC cycles (about a
+// millisecond), so threads that sleep often run soon after waking without
+// building up an unbounded claim on the CPU
+#define FAIR_WAKE_CREDIT 2000000
+
+// Weight of priority 0 under FAIR
+#define FAIR_WEIGHT_DEFAULT 1024
+
+// Signal delivered by the preemption timers
+#define PREEMPT_SIGNAL SIGALRM
+
+// Maximum number of executable segments of the main program that preemption
+// is allowed to interrupt
+#define MAX_PREEMPT_RANGES 4
+
+#ifdef UTHREAD_STATS
+// Scheduler counters of one worker, summed up by uthread_stats()
+struct worker_stats {
+    uint64_t switches;
+    uint64_t voluntary;
+    uint64_t preemptions;
+    uint64_t blocking;
+    uint64_t steals;
+    uint64_t parks;
+};
+
+// Counters are only written by the worker (or thread) they belong to, but may
+// be read from any, so they are updated without a locked instruction
+#define STAT_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define STAT_READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#endif
+
+#ifdef UTHREAD_TRACE
+#define TRACE(w, type, thread, arg) do { \
+        struct trace_ring *r = __atomic_load_n(&(w)->trace, __ATOMIC_RELAXED); \
+        if (r != NULL) \
+            trace_ring_record(r, type, thread, arg); \
+    } while (0)
+#else
+#define TRACE(w, type, thread, arg) ((void) 0)
+#endif
+
+// Per-OS-thread scheduling context. In the default mode there is a single
+// worker; uthread_init_workers() creates one per requested OS thread.
+struct worker {
+    int id;
+    struct scheduler *sched; // instance the worker belongs to
+    pthread_t pthread;
+    struct thread *current; // thread running on this worker
+    struct thread *idle;    // context that looks for work when nothing is ready
+    struct thread *prev;    // thread switched away from, see thread_switch_finish()
+    bool prev_unlock;       // prev switched away while holding sched_lock
+    unsigned yields;        // yields since the last poll for I/O
+    bool timer_fired;       // the current thread's timer expired before it slept
+    pid_t tid;              // OS thread ID, target of the preemption timer
+    bool has_timer;         // preempt_timer has been created
+    timer_t preempt_timer;  // fires on the worker's CPU time, see preempt_handler()
+    unsigned switches;      // context switches so far
+    unsigned preempt_tick;  // switches at the previous timer tick
+    spinlock lock;          // protects the runqueues below
+    thread_queue fifo_runqueue;
+    thread_pqueue ps_runqueue;
+    thread_heap heap_runqueue; // FAIR and EDF
+    int64_t min_vruntime;   // lower bound on vruntimes in heap_runqueue
+    uint64_t run_start;     // TSC when the current thread was switched to
+#ifdef UTHREAD_STATS
+    struct worker_stats stats;
+#endif
+#ifdef UTHREAD_TRACE
+    struct trace_ring *trace; // NULL unless tracing
+#endif
+};
+
+// FAIR weights per priority, from MAX_PRIORITY down to MIN_PRIORITY. Each step
+// is about 1.25x, so a thread one priority higher gets about 10% more CPU
+// time than a competing one (the weights of the Linux CFS scheduler).
+static const int fair_weights[MAX_PRIORITY - MIN_PRIORITY + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15,
+    12,
+};
+
+// Set once by the first scheduler_init(), see page_size_init()
+static size_t page_size;
+static pthread_once_t page_size_once = PTHREAD_ONCE_INIT;
+
+// Deepest stack use seen for a thread entry function
+struct stack_profile {
+    void* (*func)(void*);
+    size_t max_used;
+};
+
+// Thread table entry. Free slots are chained through next_free.
+struct thread_slot {
+    struct thread *thread;
+    uint32_t generation;
+    uint32_t next_free;
+};
+
+// Thread sleeping in uthread_wait_on(), kept on its stack
+struct addr_waiter {
+    const uint32_t *addr;
+    struct thread *thread;
+    struct addr_waiter *next;
+};
+
+// Waiters on all addresses that hash to a bucket, in arrival order
+struct wait_bucket {
+    struct addr_waiter *head;
+    struct addr_waiter *tail;
+};
+
+// Request from an OS thread that is not a worker, see inbox_post()
+struct inbox_msg {
+    uthread id;           // thread to unpark, if func is NULL
+    void* (*func)(void*); // entry function of a thread to spawn
+    void *args;
+    struct inbox_msg *next;
+};
+
+// One scheduler instance. Each OS thread that initializes the library gets
+// its own, shared only with the worker OS threads it starts, so threads of
+// different instances never contend for a lock. Thread IDs, channels and
+// synchronization objects belong to the instance they were created in.
+struct scheduler {
+    sched_policy policy;
+    size_t stack_size;
+    stack_pool stacks;                       // stacks of the default size
+    stack_pool class_stacks[STACK_CLASSES]; // other sizes, created on first use
+
+    // Open addressing table of stack_profile, protected by sched_lock like
+    // the two flags
+    struct stack_profile stack_profiles[STACK_PROFILE_SIZE];
+    bool stack_profiling;
+    bool adaptive_stacks;
+
+    struct thread_slot *threads;
+    uint32_t thread_table_size;     // slots ever handed out
+    uint32_t thread_table_capacity;
+    uint32_t free_slot;             // head of the free slot list
+    unsigned thread_count;
+
+    // Released threads, reused by thread_create() without allocating a new
+    // thread or stack. Used as a stack, so the most recently touched ones are
+    // reused first.
+    struct thread *thread_cache[THREAD_CACHE_SIZE];
+    int thread_cache_count;
+
+    timer_wheel timers;
+    int sleeper_count; // threads in timers, read without sched_lock
+
+    struct wait_bucket wait_table[WAIT_TABLE_SIZE]; // protected by sched_lock
+
+    // Lock-free stack of requests pushed by foreign OS threads and taken as
+    // a whole by workers, see inbox_drain()
+    struct inbox_msg *inbox;
+    bool inbox_used;  // a foreign thread has posted, workers listen for more
+    int parked_count; // threads in uthread_park(), protected by sched_lock
+
+    poller poller;
+
+    struct worker *workers;
+    int worker_count;
+
+    // Protects the threads table, join/detach state, thread_cache and SLP ->
+    // RDY transitions when worker_count > 1. Unused with a single worker.
+    spinlock sched_lock;
+
+    // Idle workers park here until a runqueue becomes non-empty
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+    int idle_workers;
+    bool started; // all workers were created, see worker_main()
+
+    uint64_t deadline_misses;
+
+#ifdef UTHREAD_TRACE
+    struct trace_ring **trace_rings; // one per worker, kept after tracing stops
+    struct trace_ring **trace_retired; // rings of the previous trace, see uthread_trace_start()
+    struct trace_clock trace_clock;
+    uint64_t trace_start_ns;
+#endif
+
+#ifdef UTHREAD_STATS
+    uint64_t threads_created; // protected by sched_lock
+    uint64_t threads_exited;
+    uint64_t stats_start_tsc; // for converting TSC cycles to nanoseconds
+    uint64_t stats_start_ns;
+#endif
+};
+
+// Instance of the calling OS thread, NULL if it has not initialized the
+// library and is not a worker. Workers of an instance all point to it, so a
+// uthread that resumes on another worker finds the same value here even if
+// the compiler reuses the TLS address it computed before the switch.
+static __thread struct scheduler *sched;
+
+// Instance that requests from OS threads without one go to, the first created
+static struct scheduler *default_sched;
+
+// Preemption state. Library code lives in its own section (uthread_text, see
+// the Makefile); the timer signal only interrupts code in the main program's
+// executable segments, never the library or libc.
+struct text_range {
+    uintptr_t start;
+    uintptr_t end;
+};
+
+extern const char __start_uthread_text[];
+extern const char __stop_uthread_text[];
+
+// Shared by all schedulers, set up once under preempt_mutex.
+static struct text_range preempt_ranges[MAX_PREEMPT_RANGES];
+static int preempt_range_count = 0;
+static bool preempt_handler_installed = false;
+static pthread_mutex_t preempt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct worker *curworker;
+
+// A uthread can resume on a different OS thread than the one it switched away
+// on, so the worker is looked up through a call the compiler cannot cache
+// across context_switch().
+static __attribute__((noinline)) struct worker *worker_self() {
+    return curworker;
+}
+
+#define curthread (worker_self()->current)
+
+struct thread *thread_current() {
+    return curthread;
+}
+
+void sched_lock_acquire() {
+    if (sched->worker_count > 1)
+        spinlock_lock(&sched->sched_lock);
+}
+
+void sched_lock_release() {
+    if (sched->worker_count > 1)
+        spinlock_unlock(&sched->sched_lock);
+}
+
+bool thread_precedes(struct thread *a, struct thread *b) {
+    switch (sched->policy) {
+        case PS:
+            return a->priority > b->priority;
+        case FAIR:
+            return a->vruntime < b->vruntime;
+        case EDF:
+            return a->deadline < b->deadline;
+        default:
+            return false;
+    }
+}
+
+// Adds a thread to the runqueue of w, whose lock the caller holds
+static int runqueue_insert(struct worker *w, struct thread *t) {
+    switch (sched->policy) {
+        case FIFO:
+            thread_queue_enqueue(w->fifo_runqueue, t);
+            return 0;
+        case PS:
+            thread_pqueue_enqueue(w->ps_runqueue, t);
+            return 0;
+        case FAIR:
+        case EDF:
+            return thread_heap_insert(w->heap_runqueue, t);
+        default:
+            return -1; // not yet implemented
+    }
+}
+
+// Wakes parked workers after threads were added to a runqueue, one of them or
+// all if there is enough work for several
+static void runqueue_notify(bool all) {
+    if (sched->worker_count == 1)
+        return;
+
+    // pairs with the increment in worker_park()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sched->idle_workers, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&sched->idle_mutex);
+        if (all)
+            pthread_cond_broadcast(&sched->idle_cond);
+        else
+            pthread_cond_signal(&sched->idle_cond);
+        pthread_mutex_unlock(&sched->idle_mutex);
+    }
+}
+
+// Keeps a ready thread that was suspended off the runqueues until it is
+// resumed. Requires the lock of the runqueue it would go on, or sched_lock if
+// it was about to be switched to directly.
+static bool runqueue_hold(struct thread *t) {
+    if (!t->suspended)
+        return false;
+
+    t->state = SLP;
+    t->held = true;
+    return true;
+}
+
+static void runqueue_enqueue(struct worker *w, struct thread *t) {
+    if (sched->worker_count > 1)
+        spinlock_lock(&w->lock);
+    bool held = runqueue_hold(t);
+    int err = held ? 0 : runqueue_insert(w, t);
+    if (sched->worker_count > 1)
+        spinlock_unlock(&w->lock);
+    assert(!err);
+    (void) err;
+
+    if (!held)
+        runqueue_notify(false);
+}
+
+// Adds n threads to a runqueue under a single acquisition of its lock
+static void runqueue_enqueue_batch(struct worker *w, struct thread **ts, int n) {
+    int err = 0;
+
+    if (sched->worker_count > 1)
+        spinlock_lock(&w->lock);
+    if (sched->policy == FAIR || sched->policy == EDF) {
+        err = thread_heap_insert_batch(w->heap_runqueue, ts, n);
+    } else {
+        for (int i = 0; i < n && !err; i++)
+            err = runqueue_insert(w, ts[i]);
+    }
+    if (sched->worker_count > 1)
+        spinlock_unlock(&w->lock);
+    assert(!err);
+    (void) err;
+
+    runqueue_notify(n > 1);
+}
+
+static struct thread *runqueue_dequeue(struct worker *w) {
+    struct thread *t = NULL;
+
+    if (sched->worker_count > 1)
+        spinlock_lock(&w->lock);
+    switch (sched->policy) {
+        case FIFO:
+            t = thread_queue_dequeue(w->fifo_runqueue);
+            break;
+        case PS:
+            t = thread_pqueue_dequeue(w->ps_runqueue);
+            break;
+        case FAIR:
+        case EDF:
+            t = thread_heap_extract(w->heap_runqueue);
+            if (sched->policy == FAIR && t != NULL && t->vruntime > w->min_vruntime)
+                __atomic_store_n(&w->min_vruntime, t->vruntime, __ATOMIC_RELAXED);
+            break;
+        default:
+            // not yet implemented
+    }
+    if (t != NULL && runqueue_hold(t)) {
+        // suspended while being stolen, see uthread_suspend()
+        if (sched->worker_count > 1)
+            spinlock_unlock(&w->lock);
+        return runqueue_dequeue(w);
+    }
+    if (sched->worker_count > 1)
+        spinlock_unlock(&w->lock);
+
+    return t;
+}
+
+static int runqueue_size(struct worker *w) {
+    int size = 0;
+
+    spinlock_lock(&w->lock);
+    switch (sched->policy) {
+        case FIFO:
+            size = thread_queue_size(w->fifo_runqueue);
+            break;
+        case PS:
+            size = thread_pqueue_size(w->ps_runqueue);
+            break;
+        case FAIR:
+        case EDF:
+            size = thread_heap_size(w->heap_runqueue);
+            break;
+        default:
+            // not yet implemented
+    }
+    spinlock_unlock(&w->lock);
+
+    return size;
+}
+
+// Returns whether a yielding thread t should keep running ahead of the next
+// thread on the worker's runqueue, see thread_precedes().
+static bool runqueue_yield_keeps(struct worker *w, struct thread *t) {
+    struct thread *next = NULL;
+
+    if (sched->worker_count > 1)
+        spinlock_lock(&w->lock);
+    switch (sched->policy) {
+        case PS:
+            next = thread_pqueue_peek(w->ps_runqueue);
+            break;
+        case FAIR:
+        case EDF:
+            next = thread_heap_peek(w->heap_runqueue);
+            break;
+        default:
+            // a yielding thread always goes behind the others
+    }
+    bool keep = next != NULL && thread_precedes(t, next);
+    if (sched->worker_count > 1)
+        spinlock_unlock(&w->lock);
+
+    return keep;
+}
+
+// Locks every worker's runqueue, in order. While they are held no ready
+// thread can be dequeued, stolen or requeued.
+static void runqueues_lock() {
+    if (sched->worker_count > 1) {
+        for (int i = 0; i < sched->worker_count; i++)
+            spinlock_lock(&sched->workers[i].lock);
+    }
+}
+
+static void runqueues_unlock() {
+    if (sched->worker_count > 1) {
+        for (int i = sched->worker_count - 1; i >= 0; i--)
+            spinlock_unlock(&sched->workers[i].lock);
+    }
+}
+
+// Takes a ready thread off whichever runqueue holds it, to reinsert it after
+// changing the fields that order it or to run it directly. Returns the worker
+// whose runqueue it was on, or NULL if it was not found. Requires
+// runqueues_lock().
+static struct worker *runqueue_remove(struct thread *t) {
+    for (int i = 0; i < sched->worker_count; i++) {
+        struct worker *w = &sched->workers[i];
+        switch (sched->policy) {
+            case FIFO:
+                if (thread_queue_remove(w->fifo_runqueue, t) == 0)
+                    return w;
+                break;
+            case PS:
+                if (thread_pqueue_remove(w->ps_runqueue, t) == 0)
+                    return w;
+                break;
+            case FAIR:
+            case EDF:
+                if (thread_heap_remove(w->heap_runqueue, t) == 0)
+                    return w;
+                break;
+            default:
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Takes work from the other workers' runqueues. Under FIFO half of the
+// victim's queue is moved over so that the thief does not come straight back;
+// under the other policies only the victim's next thread is taken.
+static struct thread *runqueue_steal(struct worker *w) {
+    if (sched->worker_count == 1)
+        return NULL;
+
+    for (int i = 1; i < sched->worker_count; i++) {
+        struct worker *victim = &sched->workers[(w->id + i) % sched->worker_count];
+        struct thread *stolen[STEAL_BATCH];
+        int n = 0;
+
+        spinlock_lock(&victim->lock);
+        switch (sched->policy) {
+            case FIFO: {
+                int half = (thread_queue_size(victim->fifo_runqueue) + 1) / 2;
+                if (half > STEAL_BATCH)
+                    half = STEAL_BATCH;
+                while (n < half)
+                    stolen[n++] = thread_queue_dequeue(victim->fifo_runqueue);
+                break;
+            }
+            case PS:
+                stolen[0] = thread_pqueue_dequeue(victim->ps_runqueue);
+                n = stolen[0] != NULL;
+                break;
+            case FAIR:
+            case EDF:
+                stolen[0] = thread_heap_extract(victim->heap_runqueue);
+                n = stolen[0] != NULL;
+                if (n && sched->policy == FAIR) { // keep its lead or lag relative to the other threads
+                    stolen[0]->vruntime += __atomic_load_n(&w->min_vruntime, __ATOMIC_RELAXED) -
+                        victim->min_vruntime;
+                    stolen[0]->last_worker = w->id;
+                }
+                break;
+            default:
+                // not yet implemented
+        }
+        spinlock_unlock(&victim->lock);
+
+        if (n == 0)
+            continue;
+
+        // threads suspended while in flight are held here, like in
+        // runqueue_dequeue()
+        struct thread *t = NULL;
+        spinlock_lock(&w->lock);
+        for (int j = 0; j < n; j++) {
+            if (runqueue_hold(stolen[j]))
+                continue;
+            if (t == NULL)
+                t = stolen[j];
+            else
+                thread_queue_enqueue(w->fifo_runqueue, stolen[j]);
+        }
+        spinlock_unlock(&w->lock);
+#ifdef UTHREAD_STATS
+        STAT_ADD(w->stats.steals, n);
+#endif
+
+        if (t != NULL)
+            return t;
+    }
+
+    return NULL;
+}
+
+// Charges the CPU time since the last switch to the worker's running thread
+// t: its vruntime under FAIR, weighted by its priority, and its statistics.
+static void thread_charge(struct worker *w, struct thread *t) {
+#ifndef UTHREAD_STATS
+    if (sched->policy != FAIR)
+        return;
+#endif
+
+    uint64_t now = __builtin_ia32_rdtsc();
+    uint64_t ran = now - w->run_start;
+    w->run_start = now;
+    if (t == w->idle)
+        return;
+
+    if (sched->policy == FAIR) {
+        t->vruntime += (int64_t) ran * FAIR_WEIGHT_DEFAULT / fair_weights[MAX_PRIORITY - t->priority];
+        t->last_worker = w->id;
+    }
+#ifdef UTHREAD_STATS
+    STAT_ADD(t->stats.run_cycles, ran);
+#endif
+}
+
+// Accounts a switch from prev, already in its new state, to next.
+static void thread_account(struct worker *w, struct thread *prev, struct thread *next, bool preempted) {
+    thread_charge(w, prev);
+
+#ifdef UTHREAD_STATS
+    uint64_t now = w->run_start;
+    if (prev != w->idle) {
+        switch (prev->state) {
+            case RDY:
+                if (preempted) {
+                    STAT_ADD(prev->stats.preempted, 1);
+                    STAT_ADD(w->stats.preemptions, 1);
+                } else {
+                    STAT_ADD(prev->stats.voluntary, 1);
+                    STAT_ADD(w->stats.voluntary, 1);
+                }
+                prev->stats.ready_since = now;
+                break;
+            case SLP:
+                STAT_ADD(prev->stats.blocking, 1);
+                STAT_ADD(w->stats.blocking, 1);
+                break;
+            default:
+                // exited
+        }
+    }
+    if (next != w->idle) {
+        STAT_ADD(next->stats.switches_in, 1);
+        STAT_ADD(next->stats.wait_cycles, now - next->stats.ready_since);
+        STAT_ADD(w->stats.switches, 1);
+    }
+#else
+    (void) next;
+    (void) preempted;
+#endif
+}
+
+static void thread_destroy(struct thread *t);
+static void inbox_drain();
+
+// Completes the switch away from the worker's previous thread. This runs on
+// the new thread's stack, after the previous thread's context has been saved,
+// so only now may it be handed to other workers, or released if it was a
+// detached thread that exited.
+static void thread_switch_finish() {
+    struct worker *w = worker_self();
+    struct thread *prev = w->prev;
+    if (prev != NULL) {
+        w->prev = NULL;
+        if (prev->state == RDY)
+            runqueue_enqueue(w, prev);
+        else if (prev->state == ZMB && prev->join_id == UTHREAD_DETACHED)
+            thread_destroy(prev); // sched_lock is still held
+        if (w->prev_unlock)
+            spinlock_unlock(&sched->sched_lock);
+    }
+
+    // sched_lock is free again here whichever way the switch was made, so
+    // requests are not left waiting for the next yield
+    inbox_drain();
+}
+
+static uint64_t clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Wakes sleeping threads whose deadline has passed. The caller states whether
+// it already holds sched_lock.
+static void timers_expire(bool locked) {
+    if (__atomic_load_n(&sched->sleeper_count, __ATOMIC_RELAXED) == 0)
+        return;
+
+    uint64_t now = clock_ns() / TIMER_TICK_NS;
+    if (!locked)
+        sched_lock_acquire();
+
+    struct worker *w = worker_self();
+    int woken = 0;
+    struct timer *t = timer_wheel_advance(sched->timers, now);
+    while (t != NULL) {
+        struct timer *next = t->next;
+        if (t->data == w->current)
+            w->timer_fired = true; // see thread_reschedule()
+        else
+            thread_wake(t->data);
+        woken++;
+        t = next;
+    }
+    __atomic_sub_fetch(&sched->sleeper_count, woken, __ATOMIC_RELAXED);
+
+    if (!locked)
+        sched_lock_release();
+}
+
+// Returns nanoseconds until the next timer may expire, or -1 if none is set
+static int64_t timers_timeout() {
+    if (__atomic_load_n(&sched->sleeper_count, __ATOMIC_RELAXED) == 0)
+        return -1;
+
+    sched_lock_acquire();
+    uint64_t next = timer_wheel_next(sched->timers);
+    sched_lock_release();
+    if (next == UINT64_MAX)
+        return -1;
+
+    uint64_t now = clock_ns();
+    next *= TIMER_TICK_NS;
+    return next > now ? (int64_t) (next - now) : 0;
+}
+
+void thread_execute() {
+    thread_switch_finish();
+
+    // call func(args)
+    void* retval = curthread->func(curthread->args);
+
+    // thread finished
+    uthread_exit(retval);
+}
+
+static void* thread_setup_stack(void *stack_bottom) {
+    // push context to stack in the layout context_switch() restores
+    uint64_t *sp = (uint64_t*) stack_bottom;
+    *(--sp) = 0;  // keeps rsp 16-byte aligned at the call into thread_execute
+    *(--sp) = (uint64_t) thread_execute; // return address
+    *(--sp) = 0;  // rbp
+    *(--sp) = 0;  // rbx
+    *(--sp) = 0;  // r12
+    *(--sp) = 0;  // r13
+    *(--sp) = 0;  // r14
+    *(--sp) = 0;  // r15
+    *(--sp) = DEFAULT_MXCSR | (DEFAULT_FPU_CW << 32); // MXCSR, x87 control word
+
+    return (void*) sp;
+}
+
+/*
+ * Switches from the current thread to the next ready thread, leaving the
+ * current thread in the given state.
+ *
+ * With multiple workers, callers switching to SLP or ZMB must hold sched_lock.
+ * It is released once the current thread's context has been saved, so a waker
+ * can never resume a thread that is still running. A yielding (RDY) thread is
+ * only put back on a runqueue at that point as well.
+ *
+ * preempted tells a switch forced by the preemption timer apart from a yield.
+ */
+static void thread_reschedule(thread_state state, bool preempted) {
+    assert(state != RUN);
+    struct worker *w = worker_self();
+    struct thread *oldthread = w->current;
+    assert(oldthread->state == RUN);
+
+    // callers switching to other states may hold sched_lock, which running
+    // requests needs
+    if (state == RDY)
+        inbox_drain();
+
+    // keep threads waiting for I/O from starving behind yielding threads
+    if (state == RDY && ++w->yields == POLL_INTERVAL) {
+        w->yields = 0;
+        if (poller_waiting(sched->poller))
+            poller_poll(sched->poller, 0);
+    }
+    timers_expire(state != RDY && sched->worker_count > 1);
+    if (w->timer_fired) {
+        // the thread's own sleep ended before it could switch away
+        w->timer_fired = false;
+        if (sched->worker_count > 1)
+            spinlock_unlock(&sched->sched_lock);
+        return;
+    }
+
+    // a thread suspended from another worker must switch away to be held,
+    // see uthread_suspend()
+    bool keep = state == RDY && !__atomic_load_n(&oldthread->suspended, __ATOMIC_RELAXED);
+
+    // under the ordered policies a yielding thread keeps running while it
+    // still comes first, the requeue in thread_switch_finish() would be too
+    // late for that
+    if (state == RDY && sched->policy != FIFO) {
+        thread_charge(w, oldthread);
+        if (keep && runqueue_yield_keeps(w, oldthread))
+            return;
+    }
+
+    struct thread *newthread = runqueue_dequeue(w);
+    if (newthread == NULL) {
+        newthread = runqueue_steal(w);
+        if (newthread != NULL && state == RDY && sched->policy != FIFO) {
+            // the stolen thread may not come first either
+            runqueue_enqueue(w, newthread);
+            if (keep && runqueue_yield_keeps(w, oldthread))
+                return;
+            newthread = runqueue_dequeue(w);
+        }
+    }
+    if (newthread == NULL) {
+        if (keep)
+            return; // runqueue is empty
+        newthread = w->idle; // wait for another thread to become ready
+    }
+
+    oldthread->state = state;
+    newthread->state = RUN;
+    w->current = newthread;
+    w->prev = oldthread;
+    w->prev_unlock = state != RDY && sched->worker_count > 1;
+    w->switches++;
+    thread_account(w, oldthread, newthread, preempted);
+    TRACE(w, TRACE_SWITCH, newthread->id, oldthread->id);
+
+    context_switch(&oldthread->sp, newthread->sp);
+
+    thread_switch_finish();
+}
+
+void thread_switch(thread_state state) {
+    thread_reschedule(state, false);
+}
+
+void thread_switch_to(struct thread *t, thread_state state) {
+    assert(state == RDY || state == SLP);
+    assert(t->state == SLP || t->state == RDY);
+    struct worker *w = worker_self();
+    struct thread *oldthread = w->current;
+    assert(oldthread->state == RUN);
+
+    if (runqueue_hold(t)) {
+        if (state == RDY) {
+            sched_lock_release();
+            thread_switch(RDY);
+        } else {
+            thread_switch(state); // releases sched_lock
+        }
+        return;
+    }
+
+#ifdef UTHREAD_STATS
+    if (t->state == SLP)
+        t->stats.ready_since = __builtin_ia32_rdtsc(); // never waited in a runqueue
+#endif
+    oldthread->state = state;
+    t->state = RUN;
+    w->current = t;
+    w->prev = oldthread;
+    w->prev_unlock = sched->worker_count > 1;
+    w->switches++;
+    thread_account(w, oldthread, t, false);
+    TRACE(w, TRACE_SWITCH, t->id, oldthread->id);
+
+    context_switch(&oldthread->sp, t->sp);
+
+    thread_switch_finish();
+}
+
+// Marks a sleeping thread ready, the caller then adds it to w's runqueue
+static void thread_ready(struct worker *w, struct thread *t) {
+    assert(t->state == SLP);
+
+    if (sched->policy == FAIR) {
+        // its vruntime counts against the worker it last ran on, see
+        // runqueue_steal()
+        struct worker *last = &sched->workers[t->last_worker];
+        if (last != w)
+            t->vruntime += __atomic_load_n(&w->min_vruntime, __ATOMIC_RELAXED) -
+                __atomic_load_n(&last->min_vruntime, __ATOMIC_RELAXED);
+
+        // a thread that slept does not get to catch up on all the time it
+        // missed, only on a little of it
+        int64_t floor = __atomic_load_n(&w->min_vruntime, __ATOMIC_RELAXED) - FAIR_WAKE_CREDIT;
+        if (t->vruntime < floor)
+            t->vruntime = floor;
+    }
+
+    t->state = RDY;
+#ifdef UTHREAD_STATS
+    t->stats.ready_since = __builtin_ia32_rdtsc();
+#endif
+    TRACE(w, TRACE_WAKE, t->id, w->current->id);
+}
+
+void thread_wake(struct thread* t) {
+    struct worker *w = worker_self();
+    thread_ready(w, t);
+    runqueue_enqueue(w, t);
+}
+
+// Blocks the idle context until some runqueue is non-empty, waiting in the
+// poller if threads are sleeping on I/O or timers.
+static void worker_park() {
+    int64_t timeout = timers_timeout();
+    // parked threads may be unparked by foreign OS threads, whose requests
+    // wake the poller
+    bool events_pending = poller_waiting(sched->poller) || timeout >= 0 ||
+                          __atomic_load_n(&sched->parked_count, __ATOMIC_RELAXED) > 0 ||
+                          __atomic_load_n(&sched->inbox_used, __ATOMIC_RELAXED);
+    if (events_pending && poller_poll(sched->poller, timeout) >= 0)
+        return;
+
+    if (sched->worker_count == 1) {
+        // nothing else can make a thread ready
+        fprintf(stderr, "uthread: deadlock, all threads are blocked\n");
+        abort();
+    }
+
+#ifdef UTHREAD_STATS
+    STAT_ADD(worker_self()->stats.parks, 1);
+#endif
+
+    pthread_mutex_lock(&sched->idle_mutex);
+    __atomic_add_fetch(&sched->idle_workers, 1, __ATOMIC_SEQ_CST);
+
+    bool empty = true;
+    for (int i = 0; i < sched->worker_count && empty; i++)
+        empty = runqueue_size(&sched->workers[i]) == 0;
+    // pairs with inbox_post() checking idle_workers after posting
+    empty = empty && __atomic_load_n(&sched->inbox, __ATOMIC_SEQ_CST) == NULL;
+    if (empty && events_pending) {
+        // another worker is in the poller, but it may stop polling to run
+        // the threads it wakes, so come back to check, at the latest when the
+        // next timer is due
+        int64_t wait = timeout >= 0 && timeout < PARK_TIMEOUT_NS ? timeout : PARK_TIMEOUT_NS;
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += wait;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&sched->idle_cond, &sched->idle_mutex, &deadline);
+    } else if (empty) {
+        pthread_cond_wait(&sched->idle_cond, &sched->idle_mutex);
+    }
+
+    __atomic_sub_fetch(&sched->idle_workers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sched->idle_mutex);
+}
+
+// Body of each worker's idle context: runs ready threads, stealing from other
+// workers when the local runqueue is empty.
+static void* worker_idle(void *args) {
+    (void) args;
+    for (;;) {
+        thread_switch_finish();
+        timers_expire(false);
+
+        struct worker *w = worker_self();
+        struct thread *next = runqueue_dequeue(w);
+        if (next == NULL)
+            next = runqueue_steal(w);
+        if (next == NULL) {
+            worker_park();
+            continue;
+        }
+
+        w->idle->state = SLP;
+        next->state = RUN;
+        w->current = next;
+        w->prev = w->idle;
+        w->prev_unlock = false;
+        w->switches++;
+        thread_account(w, w->idle, next, false);
+        TRACE(w, TRACE_SWITCH, next->id, w->idle->id);
+        context_switch(&w->idle->sp, next->sp);
+    }
+    return NULL;
+}
+
+// errno lives in thread-local storage, and a preempted thread may resume on a
+// different OS thread, so its location must be looked up again after a switch.
+static __attribute__((noipa)) int *errno_location() {
+    return &errno;
+}
+
+static bool preemptible(uintptr_t pc) {
+    if (pc >= (uintptr_t) __start_uthread_text && pc < (uintptr_t) __stop_uthread_text)
+        return false; // scheduler state may be inconsistent
+
+    for (int i = 0; i < preempt_range_count; i++) {
+        if (pc >= preempt_ranges[i].start && pc < preempt_ranges[i].end)
+            return true;
+    }
+    return false; // libc or another shared object, which may hold locks
+}
+
+/*
+ * Handles the preemption timer. The timer ticks twice per quantum of the
+ * worker's CPU time; a thread still running after a full tick without a
+ * context switch is moved to the back of the runqueue. Ticks that interrupt
+ * anything other than application code are ignored, the next one retries.
+ */
+static void preempt_handler(int sig, siginfo_t *info, void *context) {
+    (void) sig;
+    (void) info;
+    struct worker *w = worker_self();
+    if (w == NULL || w->current == w->idle)
+        return;
+
+    if (w->switches != w->preempt_tick) {
+        w->preempt_tick = w->switches; // thread has not run for a full tick yet
+        return;
+    }
+
+    ucontext_t *uc = context;
+    if (!preemptible(uc->uc_mcontext.gregs[REG_RIP]))
+        return;
+
+    struct thread *t = w->current;
+    if (t->preempt_disabled > 0) {
+        t->preempt_pending = true;
+        return;
+    }
+
+    int saved_errno = *errno_location();
+
+    // the signal stays blocked until the handler returns, which for this
+    // thread is only after it is scheduled again
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, PREEMPT_SIGNAL);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    thread_reschedule(RDY, true);
+
+    *errno_location() = saved_errno;
+}
+
+// Records the executable segments of the main program, the first object
+// reported by dl_iterate_phdr().
+static int preempt_ranges_callback(struct dl_phdr_info *info, size_t size, void *data) {
+    (void) size;
+    (void) data;
+    for (int i = 0; i < info->dlpi_phnum && preempt_range_count < MAX_PREEMPT_RANGES; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X))
+            continue;
+        preempt_ranges[preempt_range_count].start = info->dlpi_addr + phdr->p_vaddr;
+        preempt_ranges[preempt_range_count].end = info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz;
+        preempt_range_count++;
+    }
+    return 1; // stop after the main program
+}
+
+static int preempt_setup() {
+    pthread_mutex_lock(&preempt_mutex);
+    if (!preempt_handler_installed) {
+        if (preempt_range_count == 0)
+            dl_iterate_phdr(preempt_ranges_callback, NULL);
+
+        struct sigaction sa;
+        sa.sa_sigaction = preempt_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        preempt_handler_installed = !sigaction(PREEMPT_SIGNAL, &sa, NULL);
+    }
+    pthread_mutex_unlock(&preempt_mutex);
+
+    return preempt_handler_installed ? 0 : -1;
+}
+
+// Creates the worker's timer on its OS thread's CPU-time clock, delivering the
+// signal to that OS thread only.
+static int worker_timer_create(struct worker *w) {
+    if (w->has_timer)
+        return 0;
+
+    // worker OS threads record their ID once they start running
+    while (__atomic_load_n(&w->tid, __ATOMIC_ACQUIRE) == 0)
+        sched_yield();
+
+    clockid_t clock;
+    if (pthread_getcpuclockid(w->pthread, &clock))
+        return -1;
+
+    struct sigevent sev;
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = PREEMPT_SIGNAL;
+    sev.sigev_value.sival_ptr = w;
+    sev._sigev_un._tid = w->tid;
+    if (timer_create(clock, &sev, &w->preempt_timer))
+        return -1;
+
+    w->has_timer = true;
+    return 0;
+}
+
+_Static_assert(__builtin_offsetof(struct thread, func) == CACHE_LINE,
+               "hot fields of struct thread must fill exactly its first cache line");
+
+// Returns the thread struct kept at the top of a stack mapping, which is page
+// aligned. The stack grows down from below it.
+static struct thread *thread_on_stack(void *stack_end, size_t size) {
+    struct thread *t = (struct thread*) ((uintptr_t) stack_end + size) - 1;
+    t->stack_end = stack_end;
+    t->stack_size = size;
+    t->stack_hwm = 0;
+    t->stack_painted = false;
+    return t;
+}
+
+static void page_size_init() {
+    page_size = sysconf(_SC_PAGESIZE);
+}
+
+// Rounds a requested stack size to one stacks are allocated with: the default
+// size, or a power of two number of pages. Returns 0 if it is too large.
+static size_t stack_size_round(size_t size) {
+    size = (size + page_size - 1) & ~(page_size - 1);
+    if (size == sched->stack_size)
+        return size;
+
+    size_t class_size = page_size;
+    for (int i = 0; i < STACK_CLASSES; i++, class_size *= 2) {
+        if (class_size >= size)
+            return class_size;
+    }
+    return 0;
+}
+
+// Returns the pool for stacks of a size returned by stack_size_round(),
+// creating it if needed
+static stack_pool stack_pool_for(size_t size) {
+    if (size == sched->stack_size)
+        return sched->stacks;
+
+    int c = __builtin_ctzl(size / page_size);
+    if (sched->class_stacks[c] == NULL)
+        sched->class_stacks[c] = stack_pool_create(size, STACK_CACHE_SIZE);
+    return sched->class_stacks[c];
+}
+
+// Finds the profile of an entry function, adding it if insert is set and the
+// table has room. Requires sched_lock.
+static struct stack_profile *stack_profile_lookup(void* (*func)(void*), bool insert) {
+    uint64_t hash = (uintptr_t) func * 0x9e3779b97f4a7c15ULL;
+    uint32_t idx = hash >> (64 - __builtin_ctz(STACK_PROFILE_SIZE));
+    for (int i = 0; i < STACK_PROFILE_SIZE; i++) {
+        struct stack_profile *p = &sched->stack_profiles[(idx + i) & (STACK_PROFILE_SIZE - 1)];
+        if (p->func == func)
+            return p;
+        if (p->func == NULL) {
+            if (!insert)
+                return NULL;
+            p->func = func;
+            p->max_used = 0;
+            return p;
+        }
+    }
+    return NULL; // table is full
+}
+
+// Size of the stack for a new thread running func: the default, or under
+// adaptive sizing a smaller one with twice the deepest use seen for func
+static size_t stack_size_for(void* (*func)(void*)) {
+    if (!sched->adaptive_stacks)
+        return sched->stack_size;
+
+    struct stack_profile *p = stack_profile_lookup(func, false);
+    if (p == NULL || p->max_used == 0)
+        return sched->stack_size; // not seen yet
+
+    size_t size = 2 * p->max_used;
+    if (size < ADAPTIVE_MIN_STACK)
+        size = ADAPTIVE_MIN_STACK;
+    size = stack_size_round(size);
+    return size != 0 && size < sched->stack_size ? size : sched->stack_size;
+}
+
+// Fills the stack with STACK_CANARY up to the thread struct. Only the part a
+// previous thread used has to be filled again.
+static void stack_paint(struct thread *t) {
+    uint64_t *p = t->stack_end;
+    if (t->stack_painted)
+        p = (uint64_t*) ((uintptr_t) t->stack_end + t->stack_size - t->stack_hwm);
+
+    for (uint64_t *top = (uint64_t*) t; p < top; p++)
+        *p = STACK_CANARY;
+    t->stack_painted = true;
+}
+
+// Returns how many bytes at the top of a painted stack mapping have been used
+static size_t stack_used(struct thread *t) {
+    uint64_t *p = t->stack_end;
+    for (uint64_t *top = (uint64_t*) t; p < top && *p == STACK_CANARY; p++)
+        ;
+    return (uintptr_t) t->stack_end + t->stack_size - (uintptr_t) p;
+}
+
+static void thread_setup(struct thread *t, uthread id, void* (*func)(void*), void* args,
+                         int priority) {
+    t->id = id;
+    t->func = func;
+    t->args = args;
+    t->retval = NULL;
+    t->state = SLP;
+    t->priority = priority;
+    t->join_id = -1;
+    t->vruntime = 0;
+    t->last_worker = 0;
+    t->deadline = UTHREAD_NO_DEADLINE;
+    t->queue = NULL;
+    t->heap_index = -1;
+    t->suspended = false;
+    t->held = false;
+#ifdef UTHREAD_STATS
+    memset(&t->stats, 0, sizeof(t->stats));
+#endif
+    t->preempt_disabled = 0;
+    t->preempt_pending = false;
+    t->parked = false;
+    t->unpark_permit = false;
+    t->gen = NULL;
+
+    if (sched->stack_profiling)
+        stack_paint(t);
+    else
+        t->stack_painted = false;
+    t->sp = thread_setup_stack(t);
+}
+
+// Returns a thread struct on a stack of a size returned by stack_size_round(),
+// reusing a released thread if possible
+static struct thread *thread_alloc(size_t size) {
+    if (size == sched->stack_size && sched->thread_cache_count > 0)
+        return sched->thread_cache[--sched->thread_cache_count];
+
+    stack_pool pool = stack_pool_for(size);
+    void *stack_end = pool != NULL ? stack_pool_alloc(pool) : NULL;
+    if (stack_end == NULL)
+        return NULL; // out of memory
+    return thread_on_stack(stack_end, size);
+}
+
+static struct thread *thread_create(uthread id, void* (*func)(void*), void* args, int priority,
+                                    size_t size) {
+    struct thread *t = thread_alloc(size);
+    if (t == NULL)
+        return NULL; // out of memory
+
+    thread_setup(t, id, func, args, priority);
+    return t;
+}
+
+// Grows the thread table so that n more IDs can be reserved without failing
+static int thread_table_reserve(uint32_t n) {
+    if (sched->thread_table_capacity - sched->thread_table_size >= n)
+        return 0;
+
+    uint32_t capacity = sched->thread_table_capacity ? 2 * sched->thread_table_capacity : INITIAL_THREADS;
+    while (capacity - sched->thread_table_size < n)
+        capacity *= 2;
+    struct thread_slot *table = realloc(sched->threads, capacity * sizeof(struct thread_slot));
+    if (table == NULL)
+        return -1; // out of memory
+    sched->threads = table;
+    sched->thread_table_capacity = capacity;
+    return 0;
+}
+
+// Reserves a thread table slot and returns the ID for it, or -1 if the table
+// cannot grow. The slot stays empty until the thread is stored in it.
+static uthread thread_id_alloc() {
+    uint32_t idx = sched->free_slot;
+    if (idx != NO_SLOT) {
+        sched->free_slot = sched->threads[idx].next_free;
+        return THREAD_ID(idx, sched->threads[idx].generation);
+    }
+
+    if (thread_table_reserve(1))
+        return -1; // out of memory
+
+    idx = sched->thread_table_size++;
+    sched->threads[idx].thread = NULL;
+    sched->threads[idx].generation = 0;
+    return THREAD_ID(idx, 0);
+}
+
+// Releases a slot. Bumping the generation invalidates all IDs handed out for it.
+static void thread_id_free(uthread id) {
+    uint32_t idx = THREAD_INDEX(id);
+    sched->threads[idx].thread = NULL;
+    sched->threads[idx].generation = (sched->threads[idx].generation + 1) & INT32_MAX;
+    sched->threads[idx].next_free = sched->free_slot;
+    sched->free_slot = idx;
+}
+
+// Returns the thread with the given ID, or NULL if the ID is invalid or stale.
+static struct thread *thread_lookup(uthread id) {
+    if (id < 0 || THREAD_INDEX(id) >= sched->thread_table_size)
+        return NULL;
+
+    struct thread_slot *slot = &sched->threads[THREAD_INDEX(id)];
+    if (slot->generation != THREAD_GENERATION(id))
+        return NULL;
+    return slot->thread;
+}
+
+// Releases a terminated thread, keeping it for reuse by thread_create() if
+// the cache has room. Called with sched_lock held.
+static void thread_destroy(struct thread *t) {
+    assert(t->id != 0); // should not be destroying main thread
+    assert(t != curthread); // should not be destroying current thread
+    assert(t->state == ZMB);
+
+    TRACE(worker_self(), TRACE_REAP, t->id, curthread->id);
+    thread_id_free(t->id);
+
+    if (t->stack_painted) {
+        t->stack_hwm = stack_used(t);
+        struct stack_profile *p = stack_profile_lookup(t->func, true);
+        if (p != NULL && t->stack_hwm > p->max_used)
+            p->max_used = t->stack_hwm;
+    }
+
+    if (t->stack_size == sched->stack_size && sched->thread_cache_count < THREAD_CACHE_SIZE)
+        sched->thread_cache[sched->thread_cache_count++] = t;
+    else
+        stack_pool_free(stack_pool_for(t->stack_size), t->stack_end); // releases t with it
+
+    sched->thread_count--;
+}
+
+static int worker_setup(struct worker *w, int id) {
+    w->id = id;
+    w->sched = sched;
+    w->prev = NULL;
+    w->prev_unlock = false;
+    w->yields = 0;
+    w->timer_fired = false;
+    w->tid = 0;
+    w->has_timer = false;
+    w->switches = 0;
+    w->preempt_tick = 0;
+    w->lock = (spinlock) SPINLOCK_INIT;
+    w->fifo_runqueue = NULL;
+    w->ps_runqueue = NULL;
+    w->heap_runqueue = NULL;
+    w->min_vruntime = 0;
+    w->run_start = __builtin_ia32_rdtsc();
+#ifdef UTHREAD_TRACE
+    w->trace = NULL;
+#endif
+
+    switch (sched->policy) {
+        case FIFO:
+            w->fifo_runqueue = thread_queue_create();
+            if (w->fifo_runqueue == NULL)
+                return -1;
+            break;
+        case PS:
+            w->ps_runqueue = thread_pqueue_create();
+            if (w->ps_runqueue == NULL)
+                return -1;
+            break;
+        case FAIR:
+        case EDF:
+            w->heap_runqueue = thread_heap_create(INITIAL_THREADS, thread_precedes);
+            if (w->heap_runqueue == NULL)
+                return -1;
+            break;
+        default:
+            // not yet implemented
+    }
+
+    if (id == 0) {
+        // the calling OS thread keeps running main, so idle needs a stack
+        w->idle = thread_create(-1, worker_idle, NULL, 0, sched->stack_size);
+    } else {
+        // idle runs directly on the worker's OS thread stack
+        w->idle = aligned_alloc(CACHE_LINE, sizeof(struct thread));
+        if (w->idle != NULL) {
+            w->idle->id = -1;
+            w->idle->stack_end = NULL;
+            w->idle->stack_size = 0;
+            w->idle->stack_painted = false;
+            w->idle->sp = NULL;
+            w->idle->state = RUN;
+            w->idle->queue = NULL;
+            w->idle->suspended = false;
+            w->idle->held = false;
+            w->idle->join_id = -1;
+            w->idle->preempt_disabled = 0;
+            w->idle->preempt_pending = false;
+            w->idle->parked = false;
+            w->idle->unpark_permit = false;
+            w->idle->gen = NULL;
+        }
+    }
+    if (w->idle == NULL)
+        return -1;
+
+    return 0;
+}
+
+static void* worker_main(void *args) {
+    struct worker *w = args;
+
+    // scheduler_init() holds idle_mutex until it knows whether all workers
+    // could be created
+    pthread_mutex_lock(&w->sched->idle_mutex);
+    bool started = w->sched->started;
+    pthread_mutex_unlock(&w->sched->idle_mutex);
+    if (!started)
+        return NULL;
+
+    curworker = w;
+    sched = w->sched;
+    w->current = w->idle;
+    __atomic_store_n(&w->tid, gettid(), __ATOMIC_RELEASE);
+    worker_idle(NULL);
+    return NULL;
+}
+
+// Releases a scheduler that failed to initialize and whatever parts of it were
+// set up, the first nworkers workers among them, whose OS threads must have
+// exited. The calling OS thread is left without a scheduler.
+static void scheduler_destroy(int nworkers) {
+    for (int i = 0; i < nworkers; i++) {
+        struct worker *w = &sched->workers[i];
+        thread_queue_destroy(w->fifo_runqueue);
+        thread_pqueue_destroy(w->ps_runqueue);
+        thread_heap_destroy(w->heap_runqueue);
+        if (i == 0 && w->idle != NULL)
+            stack_pool_free(sched->stacks, w->idle->stack_end); // releases idle with it
+        else
+            free(w->idle);
+    }
+    free(sched->workers);
+
+    if (sched->thread_table_size > 0)
+        free(sched->threads[0].thread); // main thread
+    free(sched->threads);
+    poller_destroy(sched->poller);
+    timer_wheel_destroy(sched->timers);
+    stack_pool_destroy(sched->stacks);
+    pthread_cond_destroy(&sched->idle_cond);
+    pthread_mutex_destroy(&sched->idle_mutex);
+    free(sched);
+
+    sched = NULL;
+    curworker = NULL;
+}
+
+static int scheduler_init(sched_policy policy, size_t stack_sz, int nworkers) {
+    if (sched != NULL)
+        return -1;
+
+    sched = calloc(1, sizeof(struct scheduler));
+    if (sched == NULL)
+        return -1;
+
+    sched->policy = policy;
+    sched->free_slot = NO_SLOT;
+    sched->worker_count = 1;
+    sched->sched_lock = (spinlock) SPINLOCK_INIT;
+    if (pthread_mutex_init(&sched->idle_mutex, NULL) || pthread_cond_init(&sched->idle_cond, NULL)) {
+        scheduler_destroy(0);
+        return -1;
+    }
+
+    sched->stacks = stack_pool_create(stack_sz, STACK_CACHE_SIZE);
+    if (sched->stacks == NULL) {
+        scheduler_destroy(0);
+        return -1;
+    }
+    sched->stack_size = stack_pool_stack_size(sched->stacks); // rounded up to whole pages
+    pthread_once(&page_size_once, page_size_init);
+
+    sched->workers = calloc(nworkers, sizeof(struct worker));
+    if (sched->workers == NULL) {
+        scheduler_destroy(0);
+        return -1;
+    }
+    for (int i = 0; i < nworkers; i++) {
+        if (worker_setup(&sched->workers[i], i)) {
+            scheduler_destroy(i + 1); // partly set up
+            return -1;
+        }
+    }
+
+    sched->timers = timer_wheel_create(clock_ns() / TIMER_TICK_NS);
+    sched->poller = poller_create();
+    if (sched->timers == NULL || sched->poller == NULL || thread_id_alloc() != 0) {
+        scheduler_destroy(nworkers);
+        return -1;
+    }
+
+    struct thread *main_thread = aligned_alloc(CACHE_LINE, sizeof(struct thread));
+    if (main_thread == NULL) {
+        scheduler_destroy(nworkers);
+        return -1;
+    }
+    main_thread->id = 0;
+    main_thread->stack_end = NULL;
+    main_thread->stack_size = 0;
+    main_thread->stack_painted = false;
+    main_thread->sp = NULL;
+    main_thread->state = RUN;
+    main_thread->priority = 0;
+    main_thread->join_id = -1;
+    main_thread->vruntime = 0;
+    main_thread->last_worker = 0;
+    main_thread->deadline = UTHREAD_NO_DEADLINE;
+    main_thread->queue = NULL;
+    main_thread->heap_index = -1;
+    main_thread->suspended = false;
+    main_thread->held = false;
+#ifdef UTHREAD_STATS
+    memset(&main_thread->stats, 0, sizeof(main_thread->stats));
+    sched->stats_start_tsc = __builtin_ia32_rdtsc();
+    sched->stats_start_ns = clock_ns();
+#endif
+    main_thread->preempt_disabled = 0;
+    main_thread->preempt_pending = false;
+    main_thread->parked = false;
+    main_thread->unpark_permit = false;
+    main_thread->gen = NULL;
+
+    sched->workers[0].pthread = pthread_self();
+    sched->workers[0].tid = gettid();
+    curworker = &sched->workers[0];
+    curthread = main_thread; // main thread is currently running
+    sched->threads[0].thread = main_thread;
+    sched->thread_count++;
+
+    // workers only start sharing state once everything above is set up
+    sched->worker_count = nworkers;
+    pthread_mutex_lock(&sched->idle_mutex);
+    int created = 1;
+    while (created < nworkers &&
+           !pthread_create(&sched->workers[created].pthread, NULL, worker_main, &sched->workers[created]))
+        created++;
+    sched->started = created == nworkers;
+    pthread_mutex_unlock(&sched->idle_mutex);
+
+    if (!sched->started) {
+        for (int i = 1; i < created; i++)
+            pthread_join(sched->workers[i].pthread, NULL);
+        scheduler_destroy(nworkers);
+        return -1;
+    }
+
+    struct scheduler *none = NULL;
+    __atomic_compare_exchange_n(&default_sched, &none, sched, false, __ATOMIC_RELEASE,
+                                __ATOMIC_RELAXED);
+    return 0;
+}
+
+bool scheduler_initialized() {
+    return sched != NULL;
+}
+
+sched_policy scheduler_policy() {
+    return sched->policy;
+}
+
+poller scheduler_poller() {
+    return sched->poller;
+}
+
+void uthread_init(sched_policy policy, size_t stack_sz) {
+    if (scheduler_init(policy, stack_sz, 1) && sched == NULL) {
+        // every entry point relies on the scheduler existing after this
+        fprintf(stderr, "uthread: failed to initialize the scheduler\n");
+        abort();
+    }
+}
+
+int uthread_init_workers(sched_policy policy, size_t stack_sz, int nworkers) {
+    if (nworkers <= 0)
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0)
+        return -1;
+
+    return scheduler_init(policy, stack_sz, nworkers);
+}
+
+// Stores a new thread in its reserved table slot and returns its ID through
+// id. A thread without an ID to return (id is NULL) starts out detached.
+static void thread_register(struct thread *t, uthread *id) {
+    sched->threads[THREAD_INDEX(t->id)].thread = t;
+    sched->thread_count++;
+#ifdef UTHREAD_STATS
+    sched->threads_created++;
+#endif
+    TRACE(worker_self(), TRACE_CREATE, t->id, curthread->id);
+    if (id != NULL)
+        *id = t->id;
+    else
+        t->join_id = UTHREAD_DETACHED;
+}
+
+// Creates a sleeping thread with a rounded stack size, 0 for the default or,
+// with adaptive sizing, one for func. Requires sched_lock.
+static struct thread *thread_new(uthread *thread, void* (*func)(void*), void *args,
+                                 int priority, size_t size) {
+    if (sched->thread_count + 1 > MAX_THREADS)
+        return NULL; // too many threads
+
+    // reserve a slot in the threads table
+    uthread id = thread_id_alloc();
+    if (id < 0)
+        return NULL; // out of memory
+
+    struct thread *t = thread_create(id, func, args, priority,
+                                     size != 0 ? size : stack_size_for(func));
+    if (t == NULL) {
+        thread_id_free(id);
+        return NULL; // out of memory
+    }
+
+    thread_register(t, thread);
+    return t;
+}
+
+struct thread *thread_new_detached(void* (*func)(void*), void *args) {
+    return thread_new(NULL, func, args, 0, 0);
+}
+
+// Creates a thread and adds it to the runqueue, detached if thread is NULL.
+// A stack size of 0 picks the default or, with adaptive sizing, one for func.
+static int thread_spawn(uthread *thread, void* (*func)(void*), void *args, int priority,
+                        uint64_t deadline_ns, size_t stack_sz) {
+    if (sched == NULL)
+        uthread_init(FIFO, DEFAULT_STACK_SIZE);
+
+    if (priority > MAX_PRIORITY || priority < MIN_PRIORITY)
+        return -1; // invalid priority
+
+    size_t size = stack_sz != 0 ? stack_size_round(stack_sz) : 0;
+    if (stack_sz != 0 && size == 0)
+        return -1; // stack too large
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_new(thread, func, args, priority, size);
+    if (t == NULL) {
+        sched_lock_release();
+        return -1; // too many threads or out of memory
+    }
+
+    t->deadline = deadline_ns;
+
+    // add thread to runqeue
+    thread_wake(t);
+
+    sched_lock_release();
+
+    return 0;
+}
+
+int uthread_create_batch(int n, uthread *ids, void* (*func)(void*), void **args, int priority) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    if (n < 0 || priority > MAX_PRIORITY || priority < MIN_PRIORITY)
+        return -1; // invalid count or priority
+    if (n == 0)
+        return 0;
+
+    struct thread **batch = malloc(n * (sizeof(struct thread*) + sizeof(void*)));
+    if (batch == NULL)
+        return -1; // out of memory
+    void **stack_ends = (void**) (batch + n);
+
+    sched_lock_acquire();
+
+    if (sched->thread_count + n > MAX_THREADS || thread_table_reserve(n)) {
+        sched_lock_release();
+        free(batch);
+        return -1; // too many threads or out of memory
+    }
+
+    // reuse released threads first, then map stacks for the rest together
+    size_t size = stack_size_for(func);
+    stack_pool pool = stack_pool_for(size);
+    int cached = size != sched->stack_size ? 0 : n < sched->thread_cache_count ? n : sched->thread_cache_count;
+    if (pool == NULL || stack_pool_alloc_batch(pool, stack_ends, n - cached)) {
+        sched_lock_release();
+        free(batch);
+        return -1; // out of memory
+    }
+    for (int i = 0; i < cached; i++)
+        batch[i] = sched->thread_cache[--sched->thread_cache_count];
+    for (int i = cached; i < n; i++)
+        batch[i] = thread_on_stack(stack_ends[i - cached], size);
+
+    struct worker *w = worker_self();
+    for (int i = 0; i < n; i++) {
+        struct thread *t = batch[i];
+        thread_setup(t, thread_id_alloc(), func, args != NULL ? args[i] : NULL, priority);
+        thread_register(t, ids != NULL ? &ids[i] : NULL);
+        thread_ready(w, t);
+    }
+    runqueue_enqueue_batch(w, batch, n);
+
+    sched_lock_release();
+    free(batch);
+
+    return 0;
+}
+
+int uthread_create(uthread *thread, void* (*func)(void*), void *args, int priority) {
+    if (thread == NULL)
+        return -1; // invalid uthread pointer
+
+    return thread_spawn(thread, func, args, priority, UTHREAD_NO_DEADLINE, 0);
+}
+
+int uthread_create_stack(uthread *thread, void* (*func)(void*), void *args, int priority,
+                         size_t stack_sz) {
+    if (thread == NULL)
+        return -1; // invalid uthread pointer
+
+    return thread_spawn(thread, func, args, priority, UTHREAD_NO_DEADLINE, stack_sz);
+}
+
+int uthread_create_deadline(uthread *thread, void* (*func)(void*), void *args, uint64_t deadline_ns) {
+    if (thread == NULL)
+        return -1; // invalid uthread pointer
+
+    return thread_spawn(thread, func, args, 0, deadline_ns, 0);
+}
+
+int uthread_spawn(void* (*func)(void*), void *args) {
+    return thread_spawn(NULL, func, args, 0, UTHREAD_NO_DEADLINE, 0);
+}
+
+// Wakes a parked thread, or lets its next park return immediately
+static int thread_unpark(uthread id) {
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(id);
+    if (t == NULL || t->state == ZMB) {
+        sched_lock_release();
+        return -1; // invalid id or thread has terminated
+    }
+
+    if (t->parked) {
+        t->parked = false;
+        __atomic_sub_fetch(&sched->parked_count, 1, __ATOMIC_RELAXED);
+        thread_wake(t);
+    } else {
+        t->unpark_permit = true;
+    }
+
+    sched_lock_release();
+    return 0;
+}
+
+// Queues a request for the workers of s. Safe to call from any OS thread.
+static int inbox_post(struct scheduler *s, uthread id, void* (*func)(void*), void *args) {
+    if (s == NULL)
+        return -1; // no scheduler to post to
+
+    struct inbox_msg *m = malloc(sizeof(struct inbox_msg));
+    if (m == NULL)
+        return -1; // out of memory
+
+    m->id = id;
+    m->func = func;
+    m->args = args;
+    m->next = __atomic_load_n(&s->inbox, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&s->inbox, &m->next, m, true, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED))
+        ;
+
+    if (!__atomic_load_n(&s->inbox_used, __ATOMIC_RELAXED))
+        __atomic_store_n(&s->inbox_used, true, __ATOMIC_SEQ_CST);
+
+    // a worker blocked in the poller, or the next to poll, picks it up. A
+    // later request to a non-empty inbox is covered by the same wakeup.
+    if (m->next == NULL)
+        poller_notify(s->poller);
+
+    // workers parked without polling are woken directly
+    if (__atomic_load_n(&s->idle_workers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&s->idle_mutex);
+        pthread_cond_signal(&s->idle_cond);
+        pthread_mutex_unlock(&s->idle_mutex);
+    }
+    return 0;
+}
+
+// Runs all requests posted by foreign OS threads, in the order they were
+// posted. Must not be called with sched_lock held.
+static void inbox_drain() {
+    if (__atomic_load_n(&sched->inbox, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    struct inbox_msg *m = __atomic_exchange_n(&sched->inbox, NULL, __ATOMIC_ACQUIRE);
+
+    // the stack holds the newest request first
+    struct inbox_msg *ordered = NULL;
+    while (m != NULL) {
+        struct inbox_msg *next = m->next;
+        m->next = ordered;
+        ordered = m;
+        m = next;
+    }
+
+    while (ordered != NULL) {
+        m = ordered;
+        ordered = m->next;
+        if (m->func != NULL)
+            thread_spawn(NULL, m->func, m->args, 0, UTHREAD_NO_DEADLINE, 0);
+        else
+            thread_unpark(m->id);
+        free(m);
+    }
+}
+
+void uthread_park() {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    sched_lock_acquire();
+    struct thread *self = curthread;
+    if (self->unpark_permit) {
+        self->unpark_permit = false;
+        sched_lock_release();
+        return;
+    }
+
+    self->parked = true;
+    __atomic_add_fetch(&sched->parked_count, 1, __ATOMIC_RELAXED);
+    thread_switch(SLP); // releases sched_lock
+}
+
+int uthread_unpark(uthread utid) {
+    if (sched == NULL) // foreign OS thread
+        return inbox_post(__atomic_load_n(&default_sched, __ATOMIC_ACQUIRE), utid, NULL, NULL);
+    return thread_unpark(utid);
+}
+
+int uthread_submit(void* (*func)(void*), void *args) {
+    if (func == NULL)
+        return -1;
+
+    if (sched == NULL) // foreign OS thread
+        return inbox_post(__atomic_load_n(&default_sched, __ATOMIC_ACQUIRE), -1, func, args);
+    return uthread_spawn(func, args);
+}
+
+int uthread_join(uthread utid, void **retval) {
+    if (sched == NULL)
+        return -1;
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL) {
+        sched_lock_release();
+        return -1; // invalid id or thread does not exist
+    }
+
+    if (t->join_id == UTHREAD_DETACHED || t->join_id >= 0) {
+        sched_lock_release();
+        return -1; // thread is detached or already marked to join
+    }
+
+    t->join_id = curthread->id;
+
+    // block if joining thread has not terminated yet
+    if (t->state != ZMB) {
+        thread_switch(SLP); // releases sched_lock
+        sched_lock_acquire();
+    }
+    assert(t->state == ZMB);
+
+    // give return value of joining thread if not NULL
+    if (retval != NULL)
+        *retval = t->retval;
+
+    // cleanup joining thread
+    thread_destroy(t);
+
+    sched_lock_release();
+
+    return 0;
+}
+
+// Counts a miss if the thread's deadline has passed
+static void deadline_check(struct thread *t) {
+    if (t->deadline != UTHREAD_NO_DEADLINE && clock_ns() > t->deadline)
+        __atomic_add_fetch(&sched->deadline_misses, 1, __ATOMIC_RELAXED);
+}
+
+void uthread_exit(void *retval) {
+    deadline_check(curthread);
+    TRACE(worker_self(), TRACE_EXIT, curthread->id, curthread->id);
+
+    if (curthread->id == 0)
+        exit(0); // terminate process if main thread calls uthread_exit
+
+    sched_lock_acquire();
+
+#ifdef UTHREAD_STATS
+    sched->threads_exited++;
+#endif
+
+    // a detached thread is released by thread_switch_finish() once it has
+    // switched away from its stack
+    if (curthread->join_id == -1) {
+        curthread->retval = retval;
+    } else if (curthread->join_id != UTHREAD_DETACHED) {
+        thread_wake(thread_lookup(curthread->join_id));
+        curthread->retval = retval;
+    }
+    thread_switch(ZMB);
+}
+
+int uthread_detach(uthread utid) {
+    if (sched == NULL)
+        return -1;
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL) {
+        sched_lock_release();
+        return -1; // invalid id or thread does not exist
+    }
+
+    if (t->join_id != -1) {
+        sched_lock_release();
+        return -1; // thread is already detached or marked to join
+    }
+
+    t->join_id = UTHREAD_DETACHED; // mark thread as detached
+    if (t->state == ZMB)
+        thread_destroy(t); // already terminated
+
+    sched_lock_release();
+
+    return 0;
+}
+
+void uthread_yield() {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    thread_switch(RDY);
+}
+
+int uthread_yield_to(uthread utid) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL || t->state == ZMB) {
+        sched_lock_release();
+        return -1; // invalid id or thread has terminated
+    }
+
+    // a ready thread may be on any worker's runqueue, see uthread_set_priority()
+    runqueues_lock();
+    struct worker *w = t->state == RDY && !t->suspended ? runqueue_remove(t) : NULL;
+    runqueues_unlock();
+
+    if (w == NULL) {
+        // the thread is blocked, suspended, running, or about to be requeued
+        // by the worker that just switched away from it
+        sched_lock_release();
+        thread_switch(RDY);
+        return 0;
+    }
+
+    thread_switch_to(t, RDY); // releases sched_lock
+    return 0;
+}
+
+int uthread_set_priority(uthread utid, int priority) {
+    if (sched == NULL || priority > MAX_PRIORITY || priority < MIN_PRIORITY)
+        return -1; // not initialized or invalid priority
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL || t->state == ZMB) {
+        sched_lock_release();
+        return -1; // invalid id or thread has terminated
+    }
+
+    // a ready thread may be on any worker's runqueue, or about to be put back
+    // on one by thread_switch_finish(), so hold all of them while moving it
+    runqueues_lock();
+
+    bool ordered = t->state == RDY && sched->policy != FIFO;
+    struct worker *w = ordered ? runqueue_remove(t) : NULL;
+    t->priority = priority;
+    if (w != NULL)
+        runqueue_insert(w, t); // cannot fail, the thread's slot is still free
+
+    runqueues_unlock();
+    sched_lock_release();
+
+    return 0;
+}
+
+int uthread_set_deadline(uthread utid, uint64_t deadline_ns) {
+    if (sched == NULL)
+        return -1;
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL || t->state == ZMB) {
+        sched_lock_release();
+        return -1; // invalid id or thread has terminated
+    }
+
+    deadline_check(t); // the previous deadline is over either way
+
+    runqueues_lock(); // see uthread_set_priority()
+
+    bool ordered = t->state == RDY && sched->policy != FIFO;
+    struct worker *w = ordered ? runqueue_remove(t) : NULL;
+    t->deadline = deadline_ns;
+    if (w != NULL)
+        runqueue_insert(w, t); // cannot fail, the thread's slot is still free
+
+    runqueues_unlock();
+    sched_lock_release();
+
+    return 0;
+}
+
+int uthread_suspend(uthread utid) {
+    if (sched == NULL)
+        return -1;
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL || t->state == ZMB) {
+        sched_lock_release();
+        return -1; // invalid id or thread has terminated
+    }
+
+    if (t == curthread) {
+        t->suspended = true;
+        t->held = true;
+        thread_switch(SLP); // releases sched_lock
+        return 0;
+    }
+
+    // a thread that is not on a runqueue now is held when it would next be
+    // put on one or switched to, see runqueue_hold()
+    runqueues_lock();
+    t->suspended = true;
+    if (t->state == RDY && runqueue_remove(t) != NULL) {
+        t->state = SLP;
+        t->held = true;
+    }
+    runqueues_unlock();
+    sched_lock_release();
+
+    return 0;
+}
+
+int uthread_resume(uthread utid) {
+    if (sched == NULL)
+        return -1;
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL || t->state == ZMB) {
+        sched_lock_release();
+        return -1; // invalid id or thread has terminated
+    }
+
+    runqueues_lock(); // see uthread_suspend()
+    bool held = t->held;
+    t->suspended = false;
+    t->held = false;
+    runqueues_unlock();
+
+    if (held)
+        thread_wake(t);
+    sched_lock_release();
+
+    return 0;
+}
+
+uint64_t uthread_deadline_misses() {
+    if (sched == NULL)
+        return 0;
+    return __atomic_load_n(&sched->deadline_misses, __ATOMIC_RELAXED);
+}
+
+uint64_t uthread_now_ns() {
+    return clock_ns();
+}
+
+void uthread_sleep_until(uint64_t deadline_ns) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    struct timer timer;
+    timer.expires = (deadline_ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS; // never wake early
+    timer.data = curthread;
+
+    sched_lock_acquire();
+    if (deadline_ns <= clock_ns()) {
+        sched_lock_release();
+        return; // deadline already passed
+    }
+
+    // a worker blocked in the poller waits only until the timer that was
+    // earliest when it started, so have it pick up an earlier one
+    bool earliest = sched->worker_count > 1 && timer.expires < timer_wheel_next(sched->timers);
+    timer_wheel_add(sched->timers, &timer);
+    __atomic_add_fetch(&sched->sleeper_count, 1, __ATOMIC_RELAXED);
+    if (earliest)
+        poller_notify(sched->poller);
+    thread_switch(SLP); // releases sched_lock
+}
+
+void uthread_sleep_ns(uint64_t ns) {
+    if (ns == 0) {
+        uthread_yield();
+        return;
+    }
+    uthread_sleep_until(clock_ns() + ns);
+}
+
+static struct wait_bucket *wait_bucket(const uint32_t *addr) {
+    uint64_t hash = ((uintptr_t) addr >> 2) * 0x9e3779b97f4a7c15ULL; // Fibonacci hashing
+    return &sched->wait_table[hash >> (64 - __builtin_ctz(WAIT_TABLE_SIZE))];
+}
+
+int uthread_wait_on(const uint32_t *addr, uint32_t expected) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    if (addr == NULL)
+        return -1;
+
+    struct addr_waiter waiter;
+    waiter.addr = addr;
+    waiter.thread = curthread;
+    waiter.next = NULL;
+
+    // checking the value under sched_lock orders it against wakers, which
+    // change it before taking the lock
+    sched_lock_acquire();
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != expected) {
+        sched_lock_release();
+        return -1; // value already changed
+    }
+
+    struct wait_bucket *b = wait_bucket(addr);
+    if (b->tail != NULL)
+        b->tail->next = &waiter;
+    else
+        b->head = &waiter;
+    b->tail = &waiter;
+
+    thread_switch(SLP); // releases sched_lock
+    return 0;
+}
+
+int uthread_wake_addr(const uint32_t *addr, int n) {
+    if (sched == NULL || addr == NULL)
+        return 0;
+
+    int woken = 0;
+    sched_lock_acquire();
+
+    struct wait_bucket *b = wait_bucket(addr);
+    struct addr_waiter **link = &b->head;
+    struct addr_waiter *prev = NULL;
+    while (*link != NULL && woken < n) {
+        struct addr_waiter *w = *link;
+        if (w->addr != addr) {
+            prev = w;
+            link = &w->next;
+            continue;
+        }
+
+        // unlink before waking, the waiter is gone once its thread runs
+        *link = w->next;
+        if (b->tail == w)
+            b->tail = prev;
+        thread_wake(w->thread);
+        woken++;
+    }
+
+    sched_lock_release();
+    return woken;
+}
+
+void uthread_set_stack_profiling(bool enable) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    sched_lock_acquire();
+    sched->stack_profiling = enable;
+    if (!enable)
+        sched->adaptive_stacks = false; // needs the profile to stay current
+    sched_lock_release();
+}
+
+void uthread_set_adaptive_stacks(bool enable) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    sched_lock_acquire();
+    sched->adaptive_stacks = enable;
+    if (enable)
+        sched->stack_profiling = true;
+    sched_lock_release();
+}
+
+int uthread_stack_usage(uthread utid, size_t *used) {
+    if (sched == NULL || used == NULL)
+        return -1;
+
+    sched_lock_acquire();
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL || !t->stack_painted) {
+        sched_lock_release();
+        return -1; // invalid id or stack not profiled
+    }
+    *used = stack_used(t);
+    sched_lock_release();
+
+    return 0;
+}
+
+size_t uthread_stack_max(void* (*func)(void*)) {
+    if (sched == NULL)
+        return 0;
+
+    sched_lock_acquire();
+    struct stack_profile *p = stack_profile_lookup(func, false);
+    size_t max_used = p != NULL ? p->max_used : 0;
+    sched_lock_release();
+
+    return max_used;
+}
+
+int uthread_set_preemption(uint64_t quantum_ns) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    if (quantum_ns != 0 && quantum_ns < 2 * TIMER_TICK_NS)
+        return -1; // shorter than a timer tick
+
+    if (preempt_setup())
+        return -1;
+
+    struct itimerspec period;
+    period.it_interval.tv_sec = quantum_ns / 2 / 1000000000;
+    period.it_interval.tv_nsec = quantum_ns / 2 % 1000000000;
+    period.it_value = period.it_interval;
+
+    for (int i = 0; i < sched->worker_count; i++) {
+        struct worker *w = &sched->workers[i];
+        if (quantum_ns == 0 && !w->has_timer)
+            continue;
+        if (worker_timer_create(w) || timer_settime(w->preempt_timer, 0, &period, NULL))
+            return -1;
+    }
+
+    return 0;
+}
+
+void uthread_preempt_disable() {
+    if (sched == NULL)
+        return;
+    curthread->preempt_disabled++;
+}
+
+void uthread_preempt_enable() {
+    if (sched == NULL)
+        return;
+
+    struct thread *t = curthread;
+    assert(t->preempt_disabled > 0);
+    if (--t->preempt_disabled == 0 && t->preempt_pending) {
+        t->preempt_pending = false;
+        thread_switch(RDY);
+    }
+}
+
+#ifdef UTHREAD_STATS
+// Converts TSC cycles to nanoseconds, using the TSC rate measured since
+// initialization
+static uint64_t stats_cycles_to_ns(uint64_t cycles) {
+    uint64_t tsc = __builtin_ia32_rdtsc() - sched->stats_start_tsc;
+    uint64_t ns = clock_ns() - sched->stats_start_ns;
+    return tsc > 0 ? (uint64_t) ((double) cycles * ns / tsc) : 0;
+}
+
+int uthread_stats(struct uthread_stats *stats) {
+    if (sched == NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < sched->worker_count; i++) {
+        struct worker_stats *ws = &sched->workers[i].stats;
+        stats->context_switches += STAT_READ(ws->switches);
+        stats->voluntary_switches += STAT_READ(ws->voluntary);
+        stats->preemptions += STAT_READ(ws->preemptions);
+        stats->blocking_switches += STAT_READ(ws->blocking);
+        stats->steals += STAT_READ(ws->steals);
+        stats->parks += STAT_READ(ws->parks);
+    }
+
+    sched_lock_acquire();
+    stats->threads_created = sched->threads_created;
+    stats->threads_exited = sched->threads_exited;
+    stats->threads = sched->thread_count;
+    sched_lock_release();
+
+    return 0;
+}
+
+int uthread_thread_stats(uthread utid, struct uthread_thread_stats *stats) {
+    if (sched == NULL || stats == NULL)
+        return -1;
+
+    sched_lock_acquire();
+
+    struct thread *t = thread_lookup(utid);
+    if (t == NULL) {
+        sched_lock_release();
+        return -1; // invalid id or thread does not exist
+    }
+
+    // include the current time slice of a running thread
+    uint64_t run_cycles = STAT_READ(t->stats.run_cycles);
+    for (int i = 0; i < sched->worker_count; i++) {
+        struct worker *w = &sched->workers[i];
+        if (__atomic_load_n(&w->current, __ATOMIC_RELAXED) == t)
+            run_cycles += __builtin_ia32_rdtsc() - __atomic_load_n(&w->run_start, __ATOMIC_RELAXED);
+    }
+
+    stats->switches_in = STAT_READ(t->stats.switches_in);
+    stats->voluntary = STAT_READ(t->stats.voluntary);
+    stats->preempted = STAT_READ(t->stats.preempted);
+    stats->blocking = STAT_READ(t->stats.blocking);
+    stats->switches_out = stats->voluntary + stats->preempted + stats->blocking;
+    stats->run_ns = stats_cycles_to_ns(run_cycles);
+    stats->wait_ns = stats_cycles_to_ns(STAT_READ(t->stats.wait_cycles));
+
+    sched_lock_release();
+
+    return 0;
+}
+#else
+int uthread_stats(struct uthread_stats *stats) {
+    (void) stats;
+    return -1; // built without UTHREAD_STATS
+}
+
+int uthread_thread_stats(uthread utid, struct uthread_thread_stats *stats) {
+    (void) utid;
+    (void) stats;
+    return -1; // built without UTHREAD_STATS
+}
+#endif
+
+#ifdef UTHREAD_TRACE
+int uthread_trace_start(size_t events) {
+    if (sched == NULL)
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    if (events == 0)
+        return -1;
+
+    if (sched->trace_rings == NULL) {
+        struct trace_ring **rings = calloc(2 * sched->worker_count, sizeof(struct trace_ring*));
+        if (rings == NULL)
+            return -1;
+        sched->trace_rings = rings;
+        sched->trace_retired = rings + sched->worker_count;
+    }
+
+    // create all new rings before touching the current trace, which is left
+    // as it is if any of them cannot be created
+    struct trace_ring **rings = calloc(sched->worker_count, sizeof(struct trace_ring*));
+    if (rings == NULL)
+        return -1;
+    for (int i = 0; i < sched->worker_count; i++) {
+        rings[i] = trace_ring_create(events);
+        if (rings[i] == NULL) {
+            for (int j = 0; j < i; j++)
+                trace_ring_destroy(rings[j]);
+            free(rings);
+            return -1;
+        }
+    }
+
+    uthread_trace_stop();
+
+    // another worker may still be recording into a ring it loaded before the
+    // stop above, so rings are only released one trace later
+    for (int i = 0; i < sched->worker_count; i++) {
+        trace_ring_destroy(sched->trace_retired[i]);
+        sched->trace_retired[i] = sched->trace_rings[i];
+        sched->trace_rings[i] = rings[i];
+    }
+    free(rings);
+
+    sched->trace_clock.start_tsc = __builtin_ia32_rdtsc();
+    sched->trace_start_ns = clock_ns();
+    for (int i = 0; i < sched->worker_count; i++)
+        __atomic_store_n(&sched->workers[i].trace, sched->trace_rings[i], __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void uthread_trace_stop() {
+    if (sched == NULL)
+        return;
+
+    for (int i = 0; i < sched->worker_count; i++)
+        __atomic_store_n(&sched->workers[i].trace, NULL, __ATOMIC_RELAXED);
+}
+
+int uthread_trace_dump(const char *path) {
+    if (sched == NULL || sched->trace_rings == NULL)
+        return -1; // never started
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+
+    // calibrate the TSC against the clock over the whole trace
+    uint64_t cycles = __builtin_ia32_rdtsc() - sched->trace_clock.start_tsc;
+    uint64_t ns = clock_ns() - sched->trace_start_ns;
+    sched->trace_clock.us_per_cycle = cycles > 0 ? (double) ns / 1000 / cycles : 0;
+
+    bool first = true;
+    fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", f);
+    for (int i = 0; i < sched->worker_count; i++) {
+        if (sched->trace_rings[i] != NULL)
+            trace_ring_write_json(f, sched->trace_rings[i], i, &sched->trace_clock, &first);
+    }
+    fputs("\n]}\n", f);
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+#else
+int uthread_trace_start(size_t events) {
+    (void) events;
+    return -1; // built without UTHREAD_TRACE
+}
+
+void uthread_trace_stop() {
+}
+
+int uthread_trace_dump(const char *path) {
+    (void) path;
+    return -1; // built without UTHREAD_TRACE
+}
+#endif
@@ -0,0 +1,311 @@
+#include "uthread_chan.h"
+#include "uthread.h"
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Number of select cases whose waiters fit on the stack
+#define SELECT_STACK_CASES 4
+
+// Shared by the waiters of one select call, records which case fired
+struct select_state {
+    int fired;
+};
+
+// Thread sleeping on a channel, lives on the waiting thread's stack
+struct chan_waiter {
+    struct thread *thread;
+    void *elem;
+    struct select_state *sel;
+    int case_idx;
+    bool ok;
+    bool queued;
+    struct chan_waiter *next;
+    struct chan_waiter *prev;
+};
+
+struct waiter_list {
+    struct chan_waiter *head;
+    struct chan_waiter *tail;
+};
+
+// All fields are protected by sched_lock
+struct uthread_chan {
+    size_t elem_size;
+    int capacity;
+    char *buf;
+    int head;  // index of the oldest buffered element
+    int count; // number of buffered elements
+    bool closed;
+    struct waiter_list recvq;
+    struct waiter_list sendq;
+};
+
+// Picks the first case to try in select. Each OS thread, and so each worker of
+// every scheduler instance, steps its own.
+static __thread unsigned select_seed = 2463534242u;
+
+uthread_chan uthread_chan_create(size_t elem_size, int capacity) {
+    if (elem_size == 0 || capacity < 0)
+        return NULL;
+
+    uthread_chan c = calloc(1, sizeof(struct uthread_chan));
+    if (c == NULL)
+        return NULL;
+
+    if (capacity > 0) {
+        c->buf = malloc(capacity * elem_size);
+        if (c->buf == NULL) {
+            free(c);
+            return NULL;
+        }
+    }
+    c->elem_size = elem_size;
+    c->capacity = capacity;
+    return c;
+}
+
+void uthread_chan_destroy(uthread_chan c) {
+    if (c == NULL)
+        return;
+
+    free(c->buf);
+    free(c);
+}
+
+static void waiter_push(struct waiter_list *l, struct chan_waiter *w) {
+    w->next = NULL;
+    w->prev = l->tail;
+    if (l->tail != NULL)
+        l->tail->next = w;
+    else
+        l->head = w;
+    l->tail = w;
+    w->queued = true;
+}
+
+static void waiter_unlink(struct waiter_list *l, struct chan_waiter *w) {
+    if (w->prev != NULL)
+        w->prev->next = w->next;
+    else
+        l->head = w->next;
+    if (w->next != NULL)
+        w->next->prev = w->prev;
+    else
+        l->tail = w->prev;
+    w->queued = false;
+}
+
+// Removes and returns the first waiter that can still complete. Waiters of a
+// select that already fired on another channel are dropped along the way.
+static struct chan_waiter *waiter_claim(struct waiter_list *l) {
+    while (l->head != NULL) {
+        struct chan_waiter *w = l->head;
+        waiter_unlink(l, w);
+        if (w->sel == NULL)
+            return w;
+        if (w->sel->fired < 0) {
+            w->sel->fired = w->case_idx;
+            return w;
+        }
+    }
+    return NULL;
+}
+
+static inline void *buf_slot(uthread_chan c, int idx) {
+    return c->buf + ((c->head + idx) % c->capacity) * c->elem_size;
+}
+
+// Attempts a send without sleeping. On success, *receiver is set to a waiting
+// receiver that took the element, if any.
+static bool chan_try_send(uthread_chan c, const void *elem, bool *ok, struct thread **receiver) {
+    if (c->closed) {
+        *ok = false;
+        return true;
+    }
+
+    struct chan_waiter *r = waiter_claim(&c->recvq);
+    if (r != NULL) {
+        memcpy(r->elem, elem, c->elem_size);
+        r->ok = true;
+        *receiver = r->thread;
+    } else if (c->count < c->capacity) {
+        memcpy(buf_slot(c, c->count), elem, c->elem_size);
+        c->count++;
+    } else {
+        return false;
+    }
+
+    *ok = true;
+    return true;
+}
+
+// Attempts a receive without sleeping. On success, *sender is set to a
+// waiting sender whose element was taken, if any.
+static bool chan_try_recv(uthread_chan c, void *elem, bool *ok, struct thread **sender) {
+    if (c->count > 0) {
+        memcpy(elem, buf_slot(c, 0), c->elem_size);
+        c->head = (c->head + 1) % c->capacity;
+        c->count--;
+
+        // the buffer has room again, move a waiting sender's element in
+        struct chan_waiter *s = waiter_claim(&c->sendq);
+        if (s != NULL) {
+            memcpy(buf_slot(c, c->count), s->elem, c->elem_size);
+            c->count++;
+            s->ok = true;
+            *sender = s->thread;
+        }
+    } else {
+        struct chan_waiter *s = waiter_claim(&c->sendq);
+        if (s != NULL) {
+            memcpy(elem, s->elem, c->elem_size);
+            s->ok = true;
+            *sender = s->thread;
+        } else if (c->closed) {
+            *ok = false;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    *ok = true;
+    return true;
+}
+
+// Wakes the counterpart of a completed operation and releases sched_lock. A
+// receiver that was handed an element is switched to directly unless the
+// sender is scheduled ahead of it, e.g. has a higher priority under PS.
+static void chan_complete(struct thread *t, bool handoff) {
+    if (t == NULL) {
+        sched_lock_release();
+        return;
+    }
+
+    if (handoff && !thread_precedes(thread_current(), t)) {
+        thread_switch_to(t, RDY); // releases sched_lock
+        return;
+    }
+
+    thread_wake(t);
+    sched_lock_release();
+}
+
+int uthread_chan_close(uthread_chan c) {
+    if (!scheduler_initialized())
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    sched_lock_acquire();
+    if (c->closed) {
+        sched_lock_release();
+        return -1;
+    }
+    c->closed = true;
+
+    struct chan_waiter *w;
+    while ((w = waiter_claim(&c->recvq)) != NULL) {
+        w->ok = false;
+        thread_wake(w->thread);
+    }
+    while ((w = waiter_claim(&c->sendq)) != NULL) {
+        w->ok = false;
+        thread_wake(w->thread);
+    }
+    sched_lock_release();
+
+    return 0;
+}
+
+int uthread_chan_select(struct uthread_chan_case *cases, int n, bool block) {
+    if (cases == NULL || n <= 0)
+        return -1;
+    if (!scheduler_initialized())
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    sched_lock_acquire();
+
+    // try the cases starting from a random one
+    int start = 0;
+    if (n > 1) {
+        select_seed ^= select_seed << 13;
+        select_seed ^= select_seed >> 17;
+        select_seed ^= select_seed << 5;
+        start = select_seed % n;
+    }
+    for (int i = 0; i < n; i++) {
+        int idx = (start + i) % n;
+        struct uthread_chan_case *cs = &cases[idx];
+        struct thread *counterpart = NULL;
+        bool done = cs->op == UTHREAD_CHAN_SEND
+            ? chan_try_send(cs->chan, cs->elem, &cs->ok, &counterpart)
+            : chan_try_recv(cs->chan, cs->elem, &cs->ok, &counterpart);
+        if (done) {
+            chan_complete(counterpart, cs->op == UTHREAD_CHAN_SEND); // releases sched_lock
+            return idx;
+        }
+    }
+
+    if (!block) {
+        sched_lock_release();
+        return -1; // no case is ready
+    }
+
+    // sleep on every channel until one of them completes a case
+    struct chan_waiter stack_waiters[SELECT_STACK_CASES];
+    struct chan_waiter *waiters = stack_waiters;
+    if (n > SELECT_STACK_CASES) {
+        waiters = malloc(n * sizeof(struct chan_waiter));
+        if (waiters == NULL) {
+            sched_lock_release();
+            return -1; // out of memory
+        }
+    }
+
+    struct select_state sel = { -1 };
+    for (int i = 0; i < n; i++) {
+        struct chan_waiter *w = &waiters[i];
+        w->thread = thread_current();
+        w->elem = cases[i].elem;
+        w->sel = n > 1 ? &sel : NULL;
+        w->case_idx = i;
+        w->ok = false;
+        if (cases[i].op == UTHREAD_CHAN_SEND)
+            waiter_push(&cases[i].chan->sendq, w);
+        else
+            waiter_push(&cases[i].chan->recvq, w);
+    }
+
+    thread_switch(SLP); // releases sched_lock
+
+    int fired = 0;
+    if (n > 1) {
+        // take the remaining waiters off the other channels
+        sched_lock_acquire();
+        for (int i = 0; i < n; i++) {
+            if (!waiters[i].queued)
+                continue;
+            if (cases[i].op == UTHREAD_CHAN_SEND)
+                waiter_unlink(&cases[i].chan->sendq, &waiters[i]);
+            else
+                waiter_unlink(&cases[i].chan->recvq, &waiters[i]);
+        }
+        sched_lock_release();
+        fired = sel.fired;
+    }
+    cases[fired].ok = waiters[fired].ok;
+
+    if (waiters != stack_waiters)
+        free(waiters);
+    return fired;
+}
+
+int uthread_chan_send(uthread_chan c, const void *elem) {
+    struct uthread_chan_case cs = { c, UTHREAD_CHAN_SEND, (void*) elem, false };
+    return uthread_chan_select(&cs, 1, true) == 0 && cs.ok ? 0 : -1;
+}
+
+int uthread_chan_recv(uthread_chan c, void *elem) {
+    struct uthread_chan_case cs = { c, UTHREAD_CHAN_RECV, elem, false };
+    return uthread_chan_select(&cs, 1, true) == 0 && cs.ok ? 0 : -1;
+}
@@ -0,0 +1,99 @@
+#include "uthread_gen.h"
+#include "uthread.h"
+#include "scheduler.h"
+#include <stdlib.h>
+
+// All fields are protected by sched_lock
+struct uthread_gen {
+    void (*func)(void*);
+    void *args;
+    struct thread *thread; // runs the body
+    struct thread *caller; // sleeping in uthread_gen_next()
+    void *value;
+    bool done;             // body has returned
+    bool cancelled;        // being destroyed, uthread_gen_yield() fails
+};
+
+static void* gen_main(void *args) {
+    uthread_gen gen = args;
+    if (!gen->cancelled)
+        gen->func(gen->args);
+
+    // the thread exits without switching back, the consumer waits its turn
+    sched_lock_acquire();
+    gen->done = true;
+    thread_wake(gen->caller);
+    sched_lock_release();
+    return NULL;
+}
+
+uthread_gen uthread_gen_create(void (*func)(void*), void *args) {
+    if (func == NULL)
+        return NULL;
+
+    if (!scheduler_initialized())
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    uthread_gen gen = calloc(1, sizeof(struct uthread_gen));
+    if (gen == NULL)
+        return NULL;
+
+    gen->func = func;
+    gen->args = args;
+
+    sched_lock_acquire();
+    gen->thread = thread_new_detached(gen_main, gen);
+    if (gen->thread != NULL)
+        gen->thread->gen = gen;
+    sched_lock_release();
+
+    if (gen->thread == NULL) {
+        free(gen);
+        return NULL;
+    }
+    return gen;
+}
+
+void uthread_gen_destroy(uthread_gen gen) {
+    if (gen == NULL)
+        return;
+
+    // the body's thread must run to completion to be released
+    gen->cancelled = true;
+    while (uthread_gen_next(gen, NULL) == 0)
+        ;
+    free(gen);
+}
+
+int uthread_gen_next(uthread_gen gen, void **value) {
+    sched_lock_acquire();
+    if (gen->done) {
+        sched_lock_release();
+        return -1;
+    }
+
+    gen->caller = thread_current();
+    thread_switch_to(gen->thread, SLP); // releases sched_lock
+
+    // woken by the body yielding or returning
+    if (gen->done)
+        return -1;
+    if (value != NULL)
+        *value = gen->value;
+    return 0;
+}
+
+int uthread_gen_yield(void *value) {
+    if (!scheduler_initialized())
+        return -1;
+
+    uthread_gen gen = thread_current()->gen;
+    if (gen == NULL || gen->cancelled)
+        return -1;
+
+    sched_lock_acquire();
+    gen->value = value;
+    thread_switch_to(gen->caller, SLP); // releases sched_lock
+
+    return gen->cancelled ? -1 : 0;
+}
@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+#include "uthread_io.h"
+#include "uthread.h"
+#include "scheduler.h"
+#include "poller.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return -1;
+    if (flags & O_NONBLOCK)
+        return 0;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int wait_fd(int fd, uint32_t events) {
+    if (!scheduler_initialized())
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+
+    return poller_wait(scheduler_poller(), fd, events);
+}
+
+ssize_t uthread_read(int fd, void *buf, size_t count) {
+    if (set_nonblocking(fd))
+        return -1;
+
+    for (;;) {
+        ssize_t n = read(fd, buf, count);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+        if (wait_fd(fd, EPOLLIN | EPOLLRDHUP))
+            return -1;
+    }
+}
+
+ssize_t uthread_write(int fd, const void *buf, size_t count) {
+    if (set_nonblocking(fd))
+        return -1;
+
+    for (;;) {
+        ssize_t n = write(fd, buf, count);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+        if (wait_fd(fd, EPOLLOUT))
+            return -1;
+    }
+}
+
+int uthread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+    if (set_nonblocking(sockfd))
+        return -1;
+
+    for (;;) {
+        int fd = accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return fd;
+        if (wait_fd(sockfd, EPOLLIN))
+            return -1;
+    }
+}
+
+int uthread_wait_readable(int fd) {
+    return wait_fd(fd, EPOLLIN | EPOLLRDHUP);
+}
+
+int uthread_wait_writable(int fd) {
+    return wait_fd(fd, EPOLLOUT);
+}
@@ -0,0 +1,267 @@
+#include "uthread_sync.h"
+#include "uthread.h"
+#include "scheduler.h"
+#include "wait_queue.h"
+#include <stdlib.h>
+#include <stdbool.h>
+
+// All fields are protected by sched_lock
+
+struct uthread_mutex {
+    struct thread *owner;
+    struct wait_queue waiters;
+};
+
+struct uthread_cond {
+    uthread_mutex mutex; // mutex of the current waiters
+    struct wait_queue waiters;
+};
+
+struct uthread_sem {
+    int value;
+    struct wait_queue waiters;
+};
+
+static inline void ensure_initialized() {
+    if (!scheduler_initialized())
+        uthread_init(DEFAULT_SCHEDULING_POLICY, DEFAULT_STACK_SIZE);
+}
+
+// Mutex Implementation
+
+uthread_mutex uthread_mutex_create() {
+    ensure_initialized();
+
+    uthread_mutex m = malloc(sizeof(struct uthread_mutex));
+    if (m == NULL)
+        return NULL;
+
+    if (wait_queue_init(&m->waiters)) {
+        free(m);
+        return NULL;
+    }
+    m->owner = NULL;
+    return m;
+}
+
+void uthread_mutex_destroy(uthread_mutex m) {
+    if (m == NULL)
+        return;
+
+    wait_queue_destroy(&m->waiters);
+    free(m);
+}
+
+// Passes the mutex to the next waiter, or leaves it unlocked if there is
+// none. Requires sched_lock.
+static void mutex_release(uthread_mutex m) {
+    struct thread *next = wait_queue_dequeue(&m->waiters);
+    m->owner = next;
+    if (next != NULL)
+        thread_wake(next);
+}
+
+int uthread_mutex_lock(uthread_mutex m) {
+    ensure_initialized();
+    struct thread *self = thread_current();
+
+    sched_lock_acquire();
+    if (m->owner == NULL) {
+        m->owner = self;
+        sched_lock_release();
+        return 0;
+    }
+
+    if (m->owner == self) {
+        sched_lock_release();
+        return -1; // would deadlock
+    }
+    wait_queue_enqueue(&m->waiters, self);
+    thread_switch(SLP); // releases sched_lock
+
+    // the unlocking thread handed the mutex over
+    return 0;
+}
+
+int uthread_mutex_trylock(uthread_mutex m) {
+    ensure_initialized();
+    int err = -1;
+
+    sched_lock_acquire();
+    if (m->owner == NULL) {
+        m->owner = thread_current();
+        err = 0;
+    }
+    sched_lock_release();
+
+    return err;
+}
+
+int uthread_mutex_unlock(uthread_mutex m) {
+    ensure_initialized();
+
+    sched_lock_acquire();
+    if (m->owner != thread_current()) {
+        sched_lock_release();
+        return -1; // not the owner
+    }
+    mutex_release(m);
+    sched_lock_release();
+
+    return 0;
+}
+
+// Condition Variable Implementation
+
+uthread_cond uthread_cond_create() {
+    ensure_initialized();
+
+    uthread_cond c = malloc(sizeof(struct uthread_cond));
+    if (c == NULL)
+        return NULL;
+
+    if (wait_queue_init(&c->waiters)) {
+        free(c);
+        return NULL;
+    }
+    c->mutex = NULL;
+    return c;
+}
+
+void uthread_cond_destroy(uthread_cond c) {
+    if (c == NULL)
+        return;
+
+    wait_queue_destroy(&c->waiters);
+    free(c);
+}
+
+int uthread_cond_wait(uthread_cond c, uthread_mutex m) {
+    ensure_initialized();
+    struct thread *self = thread_current();
+
+    sched_lock_acquire();
+    if (m->owner != self || (c->mutex != NULL && c->mutex != m)) {
+        sched_lock_release();
+        return -1;
+    }
+    wait_queue_enqueue(&c->waiters, self);
+    c->mutex = m;
+    mutex_release(m);
+    thread_switch(SLP); // releases sched_lock
+
+    // normally the signaling thread requeued this thread on the mutex, which
+    // has since been handed over
+    sched_lock_acquire();
+    bool owner = m->owner == self;
+    sched_lock_release();
+
+    return owner ? 0 : uthread_mutex_lock(m);
+}
+
+// Moves one waiter of c to its mutex, waking it if the mutex is free.
+// Requires sched_lock.
+static void cond_wake_one(uthread_cond c) {
+    struct thread *t = wait_queue_dequeue(&c->waiters);
+    if (t == NULL)
+        return;
+
+    uthread_mutex m = c->mutex;
+    if (wait_queue_size(&c->waiters) == 0)
+        c->mutex = NULL;
+
+    if (m->owner == NULL) {
+        m->owner = t;
+        thread_wake(t);
+    } else {
+        wait_queue_enqueue(&m->waiters, t);
+    }
+}
+
+void uthread_cond_signal(uthread_cond c) {
+    ensure_initialized();
+
+    sched_lock_acquire();
+    cond_wake_one(c);
+    sched_lock_release();
+}
+
+void uthread_cond_broadcast(uthread_cond c) {
+    ensure_initialized();
+
+    sched_lock_acquire();
+    while (wait_queue_size(&c->waiters) > 0)
+        cond_wake_one(c);
+    sched_lock_release();
+}
+
+// Semaphore Implementation
+
+uthread_sem uthread_sem_create(int value) {
+    if (value < 0)
+        return NULL;
+    ensure_initialized();
+
+    uthread_sem s = malloc(sizeof(struct uthread_sem));
+    if (s == NULL)
+        return NULL;
+
+    if (wait_queue_init(&s->waiters)) {
+        free(s);
+        return NULL;
+    }
+    s->value = value;
+    return s;
+}
+
+void uthread_sem_destroy(uthread_sem s) {
+    if (s == NULL)
+        return;
+
+    wait_queue_destroy(&s->waiters);
+    free(s);
+}
+
+int uthread_sem_wait(uthread_sem s) {
+    ensure_initialized();
+
+    sched_lock_acquire();
+    if (s->value > 0) {
+        s->value--;
+        sched_lock_release();
+        return 0;
+    }
+
+    wait_queue_enqueue(&s->waiters, thread_current());
+    thread_switch(SLP); // releases sched_lock
+
+    // the posting thread handed its increment over
+    return 0;
+}
+
+int uthread_sem_trywait(uthread_sem s) {
+    ensure_initialized();
+
+    int err = -1;
+
+    sched_lock_acquire();
+    if (s->value > 0) {
+        s->value--;
+        err = 0;
+    }
+    sched_lock_release();
+
+    return err;
+}
+
+void uthread_sem_post(uthread_sem s) {
+    ensure_initialized();
+
+    sched_lock_acquire();
+    struct thread *t = wait_queue_dequeue(&s->waiters);
+    if (t != NULL)
+        thread_wake(t);
+    else
+        s->value++;
+    sched_lock_release();
+}
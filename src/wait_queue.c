@@ -0,0 +1,39 @@
+#include "wait_queue.h"
+#include "scheduler.h"
+#include <stdlib.h>
+
+int wait_queue_init(struct wait_queue *wq) {
+    wq->fifo = NULL;
+    wq->ps = NULL;
+
+    if (scheduler_policy() == PS)
+        wq->ps = thread_pqueue_create();
+    else
+        wq->fifo = thread_queue_create();
+
+    return wq->fifo == NULL && wq->ps == NULL ? -1 : 0;
+}
+
+void wait_queue_destroy(struct wait_queue *wq) {
+    thread_queue_destroy(wq->fifo);
+    thread_pqueue_destroy(wq->ps);
+}
+
+void wait_queue_enqueue(struct wait_queue *wq, struct thread *thread) {
+    if (wq->ps != NULL)
+        thread_pqueue_enqueue(wq->ps, thread);
+    else
+        thread_queue_enqueue(wq->fifo, thread);
+}
+
+struct thread* wait_queue_dequeue(struct wait_queue *wq) {
+    if (wq->ps != NULL)
+        return thread_pqueue_dequeue(wq->ps);
+    return thread_queue_dequeue(wq->fifo);
+}
+
+int wait_queue_size(struct wait_queue *wq) {
+    if (wq->ps != NULL)
+        return thread_pqueue_size(wq->ps);
+    return thread_queue_size(wq->fifo);
+}